@@ -109,7 +109,7 @@ void setup()
   printWiFiStatus();
 
   // If you want to enable some extra debugging
-  // uncomment the "#define SPOTIFY_DEBUG" in ArduinoSpotify.h
+  // uncomment the "#define SPOTIFY_LOG_LEVEL" in SpotifyLog.h
 
   Serial.println("Refreshing Access Tokens");
   if (!spotify.refreshAccessToken())
@@ -94,7 +94,7 @@ char clientSecret[] = "56t4373258u3405u43u543"; // Your client Secret of your sp
 #define ALBUM_ART "/album.jpg"
 
 // so we can compare and not download the same image if we already have it.
-String lastAlbumArtUrl;
+char lastAlbumArtUrl[SPOTIFY_URL_CHAR_LENGTH];
 
 WiFiClientSecure client;
 ArduinoSpotify spotify(client, clientId, clientSecret, SPOTIFY_REFRESH_TOKEN);
@@ -166,7 +166,7 @@ void setup() {
   client.setCACert(spotify_server_cert);
 
   // If you want to enable some extra debugging
-  // uncomment the "#define SPOTIFY_DEBUG" in ArduinoSpotify.h
+  // uncomment the "#define SPOTIFY_LOG_LEVEL" in SpotifyLog.h
 
   Serial.println("Refreshing Access Tokens");
   if (!spotify.refreshAccessToken()) {
@@ -203,7 +203,7 @@ int displayImage(char *albumArtUrl) {
   }
 }
 
-void printCurrentlyPlayingToSerial(CurrentlyPlaying currentlyPlaying)
+void printCurrentlyPlayingToSerial(CurrentlyPlaying &currentlyPlaying)
 {
     if (!currentlyPlaying.error)
     {
@@ -254,6 +254,26 @@ void printCurrentlyPlayingToSerial(CurrentlyPlaying currentlyPlaying)
     }
 }
 
+// This is only called if the request was successful, and the
+// currentlyPlaying passed in is only valid for the duration of the call.
+void currentlyPlayingCallback(CurrentlyPlaying &currentlyPlaying)
+{
+  printCurrentlyPlayingToSerial(currentlyPlaying);
+
+  // Smallest (narrowest) image will always be last.
+  SpotifyImage &smallestImage = currentlyPlaying.albumImages[currentlyPlaying.numImages - 1];
+  if (strcmp(smallestImage.url, lastAlbumArtUrl) != 0) {
+    Serial.println("Updating Art");
+    int displayImageResult = displayImage(smallestImage.url);
+    if (displayImageResult == 0) {
+      strcpy(lastAlbumArtUrl, smallestImage.url);
+    } else {
+      Serial.print("failed to display image: ");
+      Serial.println(displayImageResult);
+    }
+  }
+}
+
 void loop() {
   if (millis() > requestDueTime)
   {
@@ -261,25 +281,12 @@ void loop() {
     Serial.println(ESP.getFreeHeap());
 
     Serial.println("getting currently playing song:");
-    // Market can be excluded if you want e.g. spotify.getCurrentlyPlaying()
-    CurrentlyPlaying currentlyPlaying = spotify.getCurrentlyPlaying(SPOTIFY_MARKET);
-    if (!currentlyPlaying.error)
+    // Market can be excluded if you want e.g. spotify.getCurrentlyPlaying(currentlyPlayingCallback)
+    int status = spotify.getCurrentlyPlaying(currentlyPlayingCallback, SPOTIFY_MARKET);
+    if (status != 200)
     {
-      printCurrentlyPlayingToSerial(currentlyPlaying);
-
-      // Smallest (narrowest) image will always be last.
-      SpotifyImage smallestImage = currentlyPlaying.albumImages[currentlyPlaying.numImages - 1];
-      String newAlbum = String(smallestImage.url);
-      if (newAlbum != lastAlbumArtUrl) {
-        Serial.println("Updating Art");
-        int displayImageResult = displayImage(smallestImage.url);
-        if (displayImageResult == 0) {
-          lastAlbumArtUrl = newAlbum;
-        } else {
-          Serial.print("failed to display image: ");
-          Serial.println(displayImageResult);
-        }
-      }
+      Serial.print("Request failed with status: ");
+      Serial.println(status);
     }
 
     requestDueTime = millis() + delayBetweenRequests;
@@ -0,0 +1,150 @@
+/*******************************************************************
+    Prints your currently playing track on spotify to the
+    serial monitor using an ES32, without blocking the loop
+    while waiting on the response.
+
+    This is useful if your loop needs to keep doing something
+    else, like refreshing a display.
+
+    NOTE: You need to get a Refresh token to use this example
+    Use the getRefreshToken example to get it.
+
+    Parts:
+    ESP32 D1 Mini stlye Dev board* - http://s.click.aliexpress.com/e/C6ds4my
+
+ *  * = Affilate
+
+    If you find what I do usefuland would like to support me,
+    please consider becoming a sponsor on Github
+    https://github.com/sponsors/witnessmenow/
+
+
+    Written by Brian Lough
+    YouTube: https://www.youtube.com/brianlough
+    Tindie: https://www.tindie.com/stores/brianlough/
+    Twitter: https://twitter.com/witnessmenow
+ *******************************************************************/
+
+// ----------------------------
+// Standard Libraries
+// ----------------------------
+
+#include <WiFi.h>
+#include <WiFiClientSecure.h>
+
+// ----------------------------
+// Additional Libraries - each one of these will need to be installed.
+// ----------------------------
+
+#include <ArduinoSpotify.h>
+// Library for connecting to the Spotify API
+
+// Install from Github
+// https://github.com/witnessmenow/arduino-spotify-api
+
+#include <ArduinoJson.h>
+// Library used for parsing Json from the API responses
+
+// Search for "Arduino Json" in the Arduino Library manager
+// https://github.com/bblanchon/ArduinoJson
+
+//------- Replace the following! ------
+
+char ssid[] = "SSID";         // your network SSID (name)
+char password[] = "password"; // your network password
+
+char clientId[] = "56t4373258u3405u43u543";     // Your client ID of your spotify APP
+char clientSecret[] = "56t4373258u3405u43u543"; // Your client Secret of your spotify APP (Do Not share this!)
+
+// Country code, including this is advisable
+#define SPOTIFY_MARKET "IE"
+
+#define SPOTIFY_REFRESH_TOKEN "AAAAAAAAAABBBBBBBBBBBCCCCCCCCCCCDDDDDDDDDDD"
+
+//------- ---------------------- ------
+
+// including a "spotify_server_cert" variable
+// header is included as part of the ArduinoSpotify libary
+#include <ArduinoSpotifyCert.h>
+
+WiFiClientSecure client;
+ArduinoSpotify spotify(client, clientId, clientSecret, SPOTIFY_REFRESH_TOKEN);
+
+unsigned long delayBetweenRequests = 10000; // Time between requests (10 seconds)
+unsigned long requestDueTime;               //time when request due
+
+unsigned long loopCount = 0;
+
+// Called when the response has been parsed, only if it was successful
+void currentlyPlayingCallback(CurrentlyPlaying &currentlyPlaying)
+{
+    Serial.print("Track: ");
+    Serial.println(currentlyPlaying.trackName);
+    Serial.print("Artist: ");
+    Serial.println(currentlyPlaying.firstArtistName);
+    Serial.print("Elapsed time of song (ms): ");
+    Serial.print(currentlyPlaying.progressMs);
+    Serial.print(" of ");
+    Serial.println(currentlyPlaying.duraitonMs);
+}
+
+// Called when the request is finished, whether it worked or not
+void requestComplete(int statusCode)
+{
+    Serial.print("Request finished with status: ");
+    Serial.print(statusCode);
+    Serial.print(", loop ran ");
+    Serial.print(loopCount);
+    Serial.println(" times while waiting");
+}
+
+void setup()
+{
+
+    Serial.begin(115200);
+
+    WiFi.mode(WIFI_STA);
+    WiFi.begin(ssid, password);
+    Serial.println("");
+
+    // Wait for connection
+    while (WiFi.status() != WL_CONNECTED)
+    {
+        delay(500);
+        Serial.print(".");
+    }
+    Serial.println("");
+    Serial.print("Connected to ");
+    Serial.println(ssid);
+    Serial.print("IP address: ");
+    Serial.println(WiFi.localIP());
+
+    client.setCACert(spotify_server_cert);
+
+    spotify.requestCompleteCallback = requestComplete;
+
+    Serial.println("Refreshing Access Tokens");
+    if (!spotify.refreshAccessToken())
+    {
+        Serial.println("Failed to get access tokens");
+    }
+}
+
+void loop()
+{
+    // Reads whatever has arrived for the request in progress. When there
+    // isn't one, this also renews the access token before it expires.
+    spotify.poll();
+
+    if (millis() > requestDueTime && !spotify.isRequestInProgress())
+    {
+        loopCount = 0;
+        // Market can be excluded if you want e.g. spotify.startCurrentlyPlaying(currentlyPlayingCallback)
+        spotify.startCurrentlyPlaying(currentlyPlayingCallback, SPOTIFY_MARKET);
+
+        requestDueTime = millis() + delayBetweenRequests;
+    }
+
+    // Anything else your sketch needs to do, e.g. drawing to a display
+    loopCount++;
+}
@@ -179,7 +179,7 @@ void setup()
   }
 
   // If you want to enable some extra debugging
-  // uncomment the "#define SPOTIFY_DEBUG" in ArduinoSpotify.h
+  // uncomment the "#define SPOTIFY_LOG_LEVEL" in SpotifyLog.h
   client.setCACert(spotify_server_cert);
 
   // Building up callback URL using IP address.
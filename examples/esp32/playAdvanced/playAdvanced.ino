@@ -197,7 +197,7 @@ void setup() {
     client.setCACert(spotify_server_cert);
 
     // If you want to enable some extra debugging
-    // uncomment the "#define SPOTIFY_DEBUG" in ArduinoSpotify.h
+    // uncomment the "#define SPOTIFY_LOG_LEVEL" in SpotifyLog.h
 
     Serial.println("Refreshing Access Tokens");
     if(!spotify.refreshAccessToken()){
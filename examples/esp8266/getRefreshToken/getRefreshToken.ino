@@ -177,7 +177,7 @@ void setup()
   }
 
   // If you want to enable some extra debugging
-  // uncomment the "#define SPOTIFY_DEBUG" in ArduinoSpotify.h
+  // uncomment the "#define SPOTIFY_LOG_LEVEL" in SpotifyLog.h
   client.setFingerprint(SPOTIFY_FINGERPRINT);
 
   server.on("/", handleRoot);
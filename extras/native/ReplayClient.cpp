@@ -0,0 +1,192 @@
+#include "ReplayClient.h"
+
+void ReplayClient::addResponse(const char *pathPrefix, const std::string &body, const char *contentType, size_t chunkSize, const char *contentEncoding)
+{
+    std::string response = "HTTP/1.1 200 OK\r\n";
+    response += "Content-Type: ";
+    response += contentType;
+    response += "\r\nCache-Control: private, max-age=0\r\n";
+    response += "ETag: \"recorded\"\r\n";
+    if (contentEncoding != NULL)
+        {
+            response += "Content-Encoding: ";
+            response += contentEncoding;
+            response += "\r\n";
+        }
+    
+    if (chunkSize > 0)
+        {
+            response += "Transfer-Encoding: chunked\r\n\r\n";
+            for (size_t i = 0; i < body.size(); i += chunkSize)
+                {
+                    std::string chunk = body.substr(i, chunkSize);
+                    char chunkHeader[16];
+                    snprintf(chunkHeader, sizeof(chunkHeader), "%zx\r\n", chunk.size());
+                    response += chunkHeader + chunk + "\r\n";
+                }
+            response += "0\r\n\r\n";
+        }
+    else
+        {
+            response += "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n";
+            response += body;
+        }
+    
+    Route route;
+    route.pathPrefix = pathPrefix;
+    route.response = response;
+    _routes.push_back(route);
+}
+
+int ReplayClient::connect(const char *host, uint16_t port)
+{
+    connects++;
+    _connected = true;
+    _responses.clear();
+    _position = 0;
+    _written.clear();
+    return 1;
+}
+
+size_t ReplayClient::write(uint8_t c)
+{
+    return write(&c, 1);
+}
+
+size_t ReplayClient::write(const uint8_t *buffer, size_t size)
+{
+    if (!_connected)
+        {
+            return 0;
+        }
+    
+    _written.append((const char *)buffer, size);
+    readRequests();
+    return size;
+}
+
+void ReplayClient::readRequests()
+{
+    // Each request is its headers, then as much body as its Content-Length
+    for (;;)
+        {
+            size_t headersEnd = _written.find("\r\n\r\n");
+            if (headersEnd == std::string::npos)
+                {
+                    return;
+                }
+            
+            size_t requestLength = headersEnd + 4;
+            size_t contentLength = _written.find("Content-Length: ");
+            if (contentLength != std::string::npos && contentLength < headersEnd)
+                {
+                    requestLength += strtoul(_written.c_str() + contentLength + 16, NULL, 10);
+                }
+            if (_written.size() < requestLength)
+                {
+                    return;
+                }
+            
+            if (currentResponse() != NULL)
+                {
+                    pipelinedRequests++;
+                }
+            _responses.push_back(findResponse(_written.substr(0, _written.find("\r\n"))));
+            _written.erase(0, requestLength);
+            requests++;
+        }
+}
+
+const std::string *ReplayClient::findResponse(const std::string &requestLine)
+{
+    // e.g. "GET /v1/me/player HTTP/1.1", the longest matching prefix wins
+    size_t pathStart = requestLine.find(' ') + 1;
+    std::string path = requestLine.substr(pathStart, requestLine.find(' ', pathStart) - pathStart);
+    
+    const Route *best = NULL;
+    for (size_t i = 0; i < _routes.size(); i++)
+        {
+            const Route &route = _routes[i];
+            if (path.compare(0, route.pathPrefix.size(), route.pathPrefix) == 0 && (best == NULL || route.pathPrefix.size() > best->pathPrefix.size()))
+                {
+                    best = &route;
+                }
+        }
+    
+    if (best == NULL)
+        {
+            if (_notFound.empty())
+                {
+                    std::string body = "{\"error\":{\"status\":404,\"message\":\"No recorded reply\"}}";
+                    _notFound = "HTTP/1.1 404 Not Found\r\nContent-Type: application/json\r\nContent-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+                }
+            return &_notFound;
+        }
+    return &best->response;
+}
+
+const std::string *ReplayClient::currentResponse()
+{
+    // Moves on to the next response once the first has all been read
+    while (!_responses.empty() && _position >= _responses.front()->size())
+        {
+            _responses.pop_front();
+            _position = 0;
+        }
+    return _responses.empty() ? NULL : _responses.front();
+}
+
+int ReplayClient::available()
+{
+    const std::string *response = currentResponse();
+    return response != NULL ? (int)(response->size() - _position) : 0;
+}
+
+int ReplayClient::read()
+{
+    return available() > 0 ? (uint8_t)(*_responses.front())[_position++] : -1;
+}
+
+int ReplayClient::read(uint8_t *buffer, size_t size)
+{
+    // Only from one response at a time, like a read that stops at the
+    // end of a TLS record
+    size_t count = available();
+    if (count > size)
+        {
+            count = size;
+        }
+    if (count > 0)
+        {
+            memcpy(buffer, _responses.front()->data() + _position, count);
+            _position += count;
+        }
+    return (int)count;
+}
+
+int ReplayClient::peek()
+{
+    return available() > 0 ? (uint8_t)(*_responses.front())[_position] : -1;
+}
+
+void ReplayClient::flush()
+{
+}
+
+void ReplayClient::stop()
+{
+    _connected = false;
+    _responses.clear();
+    _position = 0;
+    _written.clear();
+}
+
+uint8_t ReplayClient::connected()
+{
+    return _connected;
+}
+
+ReplayClient::operator bool()
+{
+    return _connected;
+}
@@ -0,0 +1,63 @@
+/*
+A Client that plays back recorded Spotify responses instead of going to
+the network, picking the response by the path of each request.
+*/
+
+#ifndef ReplayClient_h
+#define ReplayClient_h
+
+#include <Client.h>
+#include <deque>
+#include <string>
+#include <vector>
+
+class ReplayClient : public Client
+{
+public:
+  // Requests whose path starts with pathPrefix get body back as a 200.
+  // With chunkSize set it is sent chunked, otherwise with a Content-Length.
+  // contentEncoding (e.g. "gzip") is only a header, body has to be encoded
+  // already.
+  void addResponse(const char *pathPrefix, const std::string &body, const char *contentType = "application/json; charset=utf-8", size_t chunkSize = 0, const char *contentEncoding = NULL);
+
+  int connect(const char *host, uint16_t port);
+  size_t write(uint8_t c);
+  size_t write(const uint8_t *buffer, size_t size);
+  int available();
+  int read();
+  int read(uint8_t *buffer, size_t size);
+  int peek();
+  void flush();
+  void stop();
+  uint8_t connected();
+  operator bool();
+
+  int connects = 0;
+  int requests = 0;
+  // Requests that came in before the response to the last one was read,
+  // i.e. pipelined
+  int pipelinedRequests = 0;
+
+private:
+  struct Route
+  {
+    std::string pathPrefix;
+    std::string response;
+  };
+
+  std::vector<Route> _routes;
+  std::string _notFound;
+  // What has been written that isn't a whole request yet
+  std::string _written;
+  // Responses are sent back to back in the order the requests came in,
+  // _position is how far into the first one has been read
+  std::deque<const std::string *> _responses;
+  size_t _position = 0;
+  bool _connected = false;
+
+  void readRequests();
+  const std::string *findResponse(const std::string &requestLine);
+  const std::string *currentResponse();
+};
+
+#endif
@@ -0,0 +1,383 @@
+/*
+Times the library's main calls against recorded responses, and counts
+how much they allocate. Build and run from the root of the repo with:
+
+  pio run -e native && .pio/build/native/program [responses folder] [iterations]
+
+The heap numbers come from wrapping glibc's malloc, so they are only
+available on Linux. They include ArduinoJson's documents and the image
+buffers, but not the stack.
+*/
+
+#include <ArduinoSpotify.h>
+#include <SpotifyPipeline.h>
+#include <malloc.h>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include "ReplayClient.h"
+
+// ----------------------------
+// Heap tracking
+// ----------------------------
+
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t count, size_t size);
+extern "C" void *__libc_realloc(void *ptr, size_t size);
+extern "C" void __libc_free(void *ptr);
+
+static long heapInUse = 0;
+static long heapPeak = 0;
+static unsigned long allocationCount = 0;
+
+static void trackAllocation(void *ptr)
+{
+    if (ptr != NULL)
+        {
+            heapInUse += malloc_usable_size(ptr);
+            if (heapInUse > heapPeak)
+                {
+                    heapPeak = heapInUse;
+                }
+            allocationCount++;
+        }
+}
+
+extern "C" void *malloc(size_t size)
+{
+    void *ptr = __libc_malloc(size);
+    trackAllocation(ptr);
+    return ptr;
+}
+
+extern "C" void *calloc(size_t count, size_t size)
+{
+    void *ptr = __libc_calloc(count, size);
+    trackAllocation(ptr);
+    return ptr;
+}
+
+extern "C" void *realloc(void *ptr, size_t size)
+{
+    if (ptr != NULL)
+        {
+            heapInUse -= malloc_usable_size(ptr);
+        }
+    void *newPtr = __libc_realloc(ptr, size);
+    trackAllocation(newPtr);
+    return newPtr;
+}
+
+extern "C" void free(void *ptr)
+{
+    if (ptr != NULL)
+        {
+            heapInUse -= malloc_usable_size(ptr);
+        }
+    __libc_free(ptr);
+}
+
+// ----------------------------
+// Benchmark
+// ----------------------------
+
+ReplayClient client;
+ArduinoSpotify spotify(client, "clientId", "clientSecret", "refreshToken");
+
+// Same recordings, but the currently playing one gzipped. It was
+// compressed in three parts so it has a block of each kind: fixed
+// Huffman codes, stored and dynamic Huffman codes.
+ReplayClient gzipClient;
+ArduinoSpotify gzipSpotify(gzipClient, "clientId", "clientSecret", "refreshToken");
+
+static size_t imageBytes;
+
+bool countImageData(uint8_t *data, size_t length, int offset, int totalLength)
+{
+    imageBytes += length;
+    return true;
+}
+
+// What the recorded playlist page should come out as. It has a removed
+// track, a null item, keys in an unusual order and values that look like
+// the end of an object, as the page is walked rather than parsed whole.
+struct ExpectedTrack
+{
+    const char *trackName;
+    const char *firstArtistName;
+    long durationMs;
+    bool error;
+};
+
+static const ExpectedTrack expectedTracks[] = {
+    {"Life on Mars? - 2015 Remaster", "David Bowie", 217346, false},
+    {"Song with \"quotes\", {braces} and [brackets] \\ \xc3\xa9", "Quoted \"Artist\"", 184000, false},
+    {"", "", 0, true},
+    {"", "", 0, true},
+    {"Short", "", 1050, false}};
+static const int expectedTrackCount = sizeof(expectedTracks) / sizeof(expectedTracks[0]);
+static int trackCount;
+static bool tracksMatch;
+
+bool checkTrack(SpotifyTrack &track, int index)
+{
+    const ExpectedTrack &expected = expectedTracks[index < expectedTrackCount ? index : 0];
+    tracksMatch = tracksMatch && index == trackCount && index < expectedTrackCount && track.error == expected.error && track.durationMs == expected.durationMs && strcmp(track.trackName, expected.trackName) == 0 && strcmp(track.firstArtistName, expected.firstArtistName) == 0;
+    trackCount++;
+    return true;
+}
+
+// The saved tracks come in three pages of two
+static const char *expectedSavedTracks[] = {
+    "Heroes - 2017 Remaster",
+    "Let's Dance - 1999 Remaster",
+    "Ashes to Ashes - 2017 Remaster",
+    "Under Pressure - Remastered 2011",
+    "Starman - 2012 Remaster"};
+static const int expectedSavedTrackCount = sizeof(expectedSavedTracks) / sizeof(expectedSavedTracks[0]);
+
+bool checkSavedTrack(SpotifyTrack &track, int index)
+{
+    tracksMatch = tracksMatch && index == trackCount && index < expectedSavedTrackCount && !track.error && strcmp(track.trackName, expectedSavedTracks[index]) == 0;
+    trackCount++;
+    return true;
+}
+
+// What sendPipeline() should hand back, from the same calls made one at a time
+static CurrentlyPlaying expected;
+static PlayerDetails expectedPlayerDetails;
+static AudioFeatures expectedAudioFeatures;
+static std::string expectedPlayerBody;
+static int pipelineCallbacks;
+static bool pipelineMatches;
+
+void checkPipelinedCurrentlyPlaying(CurrentlyPlaying &currentlyPlaying)
+{
+    pipelineMatches = pipelineMatches && !currentlyPlaying.error && currentlyPlaying.progressMs == expected.progressMs && strcmp(currentlyPlaying.trackUri, expected.trackUri) == 0 && strcmp(currentlyPlaying.albumName, expected.albumName) == 0;
+    pipelineCallbacks++;
+}
+
+void checkPipelinedPlayerDetails(PlayerDetails &playerDetails)
+{
+    pipelineMatches = pipelineMatches && !playerDetails.error && playerDetails.progressMs == expectedPlayerDetails.progressMs && playerDetails.isPlaying == expectedPlayerDetails.isPlaying && strcmp(playerDetails.device.id, expectedPlayerDetails.device.id) == 0;
+    pipelineCallbacks++;
+}
+
+void checkPipelinedAudioFeatures(AudioFeatures &audioFeatures)
+{
+    pipelineMatches = pipelineMatches && !audioFeatures.error && audioFeatures.tempo == expectedAudioFeatures.tempo && audioFeatures.key == expectedAudioFeatures.key && audioFeatures.duration_ms == expectedAudioFeatures.duration_ms;
+    pipelineCallbacks++;
+}
+
+void checkPipelinedResponse(int statusCode, Stream &body)
+{
+    std::string received;
+    int c;
+    while ((c = body.read()) >= 0)
+        {
+            received += (char)c;
+        }
+    pipelineMatches = pipelineMatches && statusCode == 200 && received == expectedPlayerBody;
+    pipelineCallbacks++;
+}
+
+std::string readResponse(const std::string &folder, const char *fileName)
+{
+    std::ifstream file(folder + "/" + fileName, std::ios::binary);
+    if (!file)
+        {
+            fprintf(stderr, "Could not open %s/%s\n", folder.c_str(), fileName);
+            exit(1);
+        }
+    std::stringstream contents;
+    contents << file.rdbuf();
+    return contents.str();
+}
+
+std::string makeImage(size_t size)
+{
+    // Only the size matters, the library doesn't look inside it
+    std::string image(size, '\0');
+    image[0] = (char)0xFF;
+    image[1] = (char)0xD8;
+    for (size_t i = 2; i < size; i++)
+        {
+            image[i] = (char)rand();
+        }
+    return image;
+}
+
+template <typename Call>
+void benchmark(const char *name, int iterations, Call call)
+{
+    unsigned long minUs = (unsigned long)-1;
+    unsigned long maxUs = 0;
+    unsigned long long totalUs = 0;
+    long worstPeak = 0;
+    unsigned long totalAllocations = 0;
+    int failures = 0;
+    
+    for (int i = 0; i < iterations; i++)
+        {
+            long heapBefore = heapInUse;
+            heapPeak = heapInUse;
+            unsigned long allocationsBefore = allocationCount;
+            
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            bool ok = call();
+            unsigned long us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+            
+            if (!ok)
+                {
+                    failures++;
+                }
+            totalUs += us;
+            minUs = us < minUs ? us : minUs;
+            maxUs = us > maxUs ? us : maxUs;
+            worstPeak = heapPeak - heapBefore > worstPeak ? heapPeak - heapBefore : worstPeak;
+            totalAllocations += allocationCount - allocationsBefore;
+        }
+    
+    printf("%-32s %8d %10llu %10lu %10lu %12ld %10.1f %8d\n", name, iterations, totalUs / iterations, minUs, maxUs, worstPeak, (double)totalAllocations / iterations, failures);
+}
+
+int main(int argc, char **argv)
+{
+    std::string folder = argc > 1 ? argv[1] : "extras/native/responses";
+    int iterations = argc > 2 ? atoi(argv[2]) : 1000;
+    
+    client.addResponse(SPOTIFY_TOKEN_ENDPOINT, readResponse(folder, "token.json"));
+    client.addResponse(SPOTIFY_CURRENTLY_PLAYING_ENDPOINT, readResponse(folder, "currently-playing.json"), "application/json; charset=utf-8", 1024);
+    client.addResponse(SPOTIFY_PLAYER_ENDPOINT, readResponse(folder, "player.json"));
+    client.addResponse(SPOTIFY_AUDIO_FEATURES_ENDPOINT, readResponse(folder, "audio-features.json"));
+    // Roughly the sizes of the 64px and 640px album art
+    client.addResponse("/image/small", makeImage(3 * 1024), "image/jpeg");
+    client.addResponse("/image/large", makeImage(80 * 1024), "image/jpeg");
+    
+    client.addResponse("/v1/playlists/", readResponse(folder, "playlist-tracks.json"), "application/json; charset=utf-8", 1024);
+    client.addResponse("/v1/me/tracks?limit=2&offset=0", readResponse(folder, "saved-tracks-1.json"), "application/json; charset=utf-8", 1024);
+    client.addResponse("/v1/me/tracks?limit=2&offset=2", readResponse(folder, "saved-tracks-2.json"), "application/json; charset=utf-8", 1024);
+    client.addResponse("/v1/me/tracks?limit=2&offset=4", readResponse(folder, "saved-tracks-3.json"), "application/json; charset=utf-8", 1024);
+    gzipClient.addResponse(SPOTIFY_TOKEN_ENDPOINT, readResponse(folder, "token.json"));
+    gzipClient.addResponse(SPOTIFY_CURRENTLY_PLAYING_ENDPOINT, readResponse(folder, "currently-playing.json.gz"), "application/json; charset=utf-8", 1024, "gzip");
+    
+    spotify.keepAlive = true;
+    gzipSpotify.keepAlive = true;
+    gzipSpotify.gzip = true;
+    
+    // The debug output would be most of what gets timed
+    Serial.setOutput(NULL);
+    
+    if (!spotify.refreshAccessToken() || !gzipSpotify.refreshAccessToken())
+        {
+            fprintf(stderr, "Failed to get the access token from the recorded response\n");
+            return 1;
+        }
+    
+    printf("%-32s %8s %10s %10s %10s %12s %10s %8s\n", "call", "runs", "mean (us)", "min (us)", "max (us)", "peak heap", "allocs", "failed");
+    
+    benchmark("getCurrentlyPlaying", iterations, []() {
+        CurrentlyPlaying currentlyPlaying;
+        return spotify.getCurrentlyPlaying(currentlyPlaying, "IE") == 200;
+    });
+    
+    // The gzipped response has to come out exactly the same as the plain one
+    memset(&expected, 0, sizeof(expected));
+    spotify.getCurrentlyPlaying(expected, "IE");
+    benchmark("getCurrentlyPlaying (gzip)", iterations, []() {
+        CurrentlyPlaying currentlyPlaying;
+        memset(&currentlyPlaying, 0, sizeof(currentlyPlaying));
+        return gzipSpotify.getCurrentlyPlaying(currentlyPlaying, "IE") == 200 && memcmp(&currentlyPlaying, &expected, sizeof(expected)) == 0;
+    });
+    
+    benchmark("getPlayerDetails", iterations, []() {
+        PlayerDetails playerDetails;
+        return spotify.getPlayerDetails(playerDetails, "IE") == 200;
+    });
+    
+    benchmark("getAudioFeatures", iterations, []() {
+        AudioFeatures audioFeatures;
+        return spotify.getAudioFeatures(audioFeatures, "spotify:track:0WtM2NBVQNNJLh6scP13H8") == 200;
+    });
+    
+    // Same track every time, so audio features are only fetched once
+    static PlayerSnapshot snapshot;
+    benchmark("getPlayerSnapshot", iterations, []() {
+        return spotify.getPlayerSnapshot(snapshot, "IE") == 200 && !snapshot.audioFeatures.error;
+    });
+    
+    benchmark("getPlaylistTracks", iterations, []() {
+        trackCount = 0;
+        tracksMatch = true;
+        return spotify.getPlaylistTracks("3cEYpjA9oz9GiPac4AsH4n", checkTrack) == 200 && tracksMatch && trackCount == expectedTrackCount;
+    });
+    
+    // The total isn't known until the first page has been read, so the
+    // last page is the one that goes out behind the page being read.
+    // Falling back to asking again would show up as a fourth request, or
+    // as none of them being pipelined.
+    benchmark("getSavedTracks (prefetch)", iterations, []() {
+        trackCount = 0;
+        tracksMatch = true;
+        int requestsBefore = client.requests;
+        int pipelinedBefore = client.pipelinedRequests;
+        spotify.pagingLimit = 2;
+        int statusCode = spotify.getSavedTracks(checkSavedTrack);
+        spotify.pagingLimit = 50;
+        return statusCode == 200 && tracksMatch && trackCount == expectedSavedTrackCount && client.requests - requestsBefore == 3 && client.pipelinedRequests - pipelinedBefore == 1;
+    });
+    
+    memset(&expectedPlayerDetails, 0, sizeof(expectedPlayerDetails));
+    memset(&expectedAudioFeatures, 0, sizeof(expectedAudioFeatures));
+    spotify.getPlayerDetails(expectedPlayerDetails, "IE");
+    spotify.getAudioFeatures(expectedAudioFeatures, "spotify:track:0WtM2NBVQNNJLh6scP13H8");
+    expectedPlayerBody = readResponse(folder, "player.json");
+    benchmark("sendPipeline (4 requests)", iterations, []() {
+        SpotifyPipeline pipeline;
+        pipeline.addCurrentlyPlaying(checkPipelinedCurrentlyPlaying, "IE");
+        pipeline.addPlayerDetails(checkPipelinedPlayerDetails, "IE");
+        pipeline.addAudioFeatures(checkPipelinedAudioFeatures, "spotify:track:0WtM2NBVQNNJLh6scP13H8");
+        pipeline.add(SPOTIFY_PLAYER_ENDPOINT, checkPipelinedResponse);
+        
+        pipelineCallbacks = 0;
+        pipelineMatches = true;
+        int requestsBefore = client.requests;
+        int pipelinedBefore = client.pipelinedRequests;
+        if (spotify.sendPipeline(pipeline) != pipeline.getCount())
+            {
+                return false;
+            }
+        for (int i = 0; i < pipeline.getCount(); i++)
+            {
+                pipelineMatches = pipelineMatches && pipeline.getStatusCode(i) == 200;
+            }
+        return pipelineMatches && pipelineCallbacks == pipeline.getCount() && client.requests - requestsBefore == pipeline.getCount() && client.pipelinedRequests - pipelinedBefore == pipeline.getCount() - 1;
+    });
+    
+    benchmark("refreshAccessToken", iterations, []() {
+        return spotify.refreshAccessToken();
+    });
+    
+    char smallImage[] = "https://i.scdn.co/image/small";
+    char largeImage[] = "https://i.scdn.co/image/large";
+    
+    benchmark("getImage (callback, 3KB)", iterations, [&]() {
+        imageBytes = 0;
+        return spotify.getImage(smallImage, countImageData) && imageBytes == 3 * 1024;
+    });
+    
+    benchmark("getImage (callback, 80KB)", iterations, [&]() {
+        imageBytes = 0;
+        return spotify.getImage(largeImage, countImageData) && imageBytes == 80 * 1024;
+    });
+    
+    benchmark("getImage (RAM, 80KB)", iterations, [&]() {
+        uint8_t *imageData;
+        int size = spotify.getImage(largeImage, &imageData);
+        free(imageData);
+        return size == 80 * 1024;
+    });
+    
+    printf("\n%d connections, %d requests\n", client.connects + gzipClient.connects, client.requests + gzipClient.requests);
+    return 0;
+}
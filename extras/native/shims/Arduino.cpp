@@ -0,0 +1,215 @@
+#include "Arduino.h"
+#include <chrono>
+
+HardwareSerial Serial;
+
+static const std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+unsigned long millis()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+unsigned long micros()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+void delay(unsigned long ms)
+{
+    unsigned long start = millis();
+    while (millis() - start < ms)
+        {
+        }
+}
+
+void yield()
+{
+}
+
+long random(long max)
+{
+    return max > 0 ? rand() % max : 0;
+}
+
+long random(long min, long max)
+{
+    return max > min ? min + random(max - min) : min;
+}
+
+size_t Print::write(const uint8_t *buffer, size_t size)
+{
+    size_t written = 0;
+    while (size--)
+        {
+            written += write(*buffer++);
+        }
+    return written;
+}
+
+size_t Print::print(long n, int base)
+{
+    char buffer[24];
+    snprintf(buffer, sizeof(buffer), base == HEX ? "%lx" : "%ld", n);
+    return write(buffer);
+}
+
+size_t Print::print(unsigned long n, int base)
+{
+    char buffer[24];
+    snprintf(buffer, sizeof(buffer), base == HEX ? "%lx" : "%lu", n);
+    return write(buffer);
+}
+
+size_t Print::print(double n, int digits)
+{
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%.*f", digits, n);
+    return write(buffer);
+}
+
+int Stream::timedRead()
+{
+    unsigned long start = millis();
+    do
+        {
+            int c = read();
+            if (c >= 0)
+                {
+                    return c;
+                }
+        }
+    while (millis() - start < _timeout);
+    return -1;
+}
+
+int Stream::timedPeek()
+{
+    unsigned long start = millis();
+    do
+        {
+            int c = peek();
+            if (c >= 0)
+                {
+                    return c;
+                }
+        }
+    while (millis() - start < _timeout);
+    return -1;
+}
+
+bool Stream::find(const char *target)
+{
+    size_t length = strlen(target);
+    size_t index = 0;
+    int c;
+    while ((c = timedRead()) >= 0)
+        {
+            if (c == target[index])
+                {
+                    if (++index == length)
+                        {
+                            return true;
+                        }
+                }
+            else
+                {
+                    index = (c == target[0]) ? 1 : 0;
+                }
+        }
+    return false;
+}
+
+bool Stream::findUntil(const char *target, const char *terminator)
+{
+    size_t targetLength = strlen(target);
+    size_t terminatorLength = strlen(terminator);
+    size_t targetIndex = 0;
+    size_t terminatorIndex = 0;
+    int c;
+    while ((c = timedRead()) >= 0)
+        {
+            targetIndex = (c == target[targetIndex]) ? targetIndex + 1 : (c == target[0] ? 1 : 0);
+            if (targetIndex == targetLength)
+                {
+                    return true;
+                }
+            terminatorIndex = (c == terminator[terminatorIndex]) ? terminatorIndex + 1 : (c == terminator[0] ? 1 : 0);
+            if (terminatorIndex == terminatorLength)
+                {
+                    return false;
+                }
+        }
+    return false;
+}
+
+long Stream::parseInt()
+{
+    int c;
+    while ((c = timedPeek()) >= 0 && !isdigit(c) && c != '-')
+        {
+            read();
+        }
+    
+    bool negative = c == '-';
+    if (negative)
+        {
+            read();
+        }
+    
+    long value = 0;
+    while ((c = timedPeek()) >= 0 && isdigit(c))
+        {
+            value = value * 10 + (c - '0');
+            read();
+        }
+    return negative ? -value : value;
+}
+
+size_t Stream::readBytes(char *buffer, size_t length)
+{
+    size_t count = 0;
+    while (count < length)
+        {
+            int c = timedRead();
+            if (c < 0)
+                {
+                    break;
+                }
+            buffer[count++] = (char)c;
+        }
+    return count;
+}
+
+size_t Stream::readBytesUntil(char terminator, char *buffer, size_t length)
+{
+    size_t count = 0;
+    while (count < length)
+        {
+            int c = timedRead();
+            if (c < 0 || c == terminator)
+                {
+                    break;
+                }
+            buffer[count++] = (char)c;
+        }
+    return count;
+}
+
+size_t HardwareSerial::write(uint8_t c)
+{
+    if (_output != NULL)
+        {
+            fputc(c, _output);
+        }
+    return 1;
+}
+
+size_t HardwareSerial::write(const uint8_t *buffer, size_t size)
+{
+    if (_output != NULL)
+        {
+            fwrite(buffer, 1, size, _output);
+        }
+    return size;
+}
@@ -0,0 +1,102 @@
+/*
+Just enough of the Arduino core to build the library on a computer, for
+the benchmark in extras/native. Not a full implementation, only what the
+library and ArduinoJson use.
+*/
+
+#ifndef Arduino_h
+#define Arduino_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <time.h>
+
+typedef uint8_t byte;
+
+class __FlashStringHelper;
+#define F(string_literal) (reinterpret_cast<const __FlashStringHelper *>(string_literal))
+#define PROGMEM
+
+#define DEC 10
+#define HEX 16
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void yield();
+long random(long max);
+long random(long min, long max);
+
+class Print
+{
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t *buffer, size_t size);
+  size_t write(const char *str) { return str == NULL ? 0 : write((const uint8_t *)str, strlen(str)); }
+  size_t write(const char *buffer, size_t size) { return write((const uint8_t *)buffer, size); }
+  virtual void flush() {}
+
+  size_t print(const __FlashStringHelper *str) { return write((const char *)str); }
+  size_t print(const char *str) { return write(str); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(int n, int base = DEC) { return print((long)n, base); }
+  size_t print(unsigned int n, int base = DEC) { return print((unsigned long)n, base); }
+  size_t print(long n, int base = DEC);
+  size_t print(unsigned long n, int base = DEC);
+  size_t print(double n, int digits = 2);
+  size_t print(bool b) { return print((int)b); }
+
+  size_t println() { return write("\r\n"); }
+  template <typename T>
+  size_t println(T value) { return print(value) + println(); }
+  template <typename T>
+  size_t println(T value, int format) { return print(value, format) + println(); }
+};
+
+class Stream : public Print
+{
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+
+  void setTimeout(unsigned long timeout) { _timeout = timeout; }
+  unsigned long getTimeout() { return _timeout; }
+  bool find(const char *target);
+  bool findUntil(const char *target, const char *terminator);
+  long parseInt();
+  size_t readBytes(char *buffer, size_t length);
+  size_t readBytes(uint8_t *buffer, size_t length) { return readBytes((char *)buffer, length); }
+  size_t readBytesUntil(char terminator, char *buffer, size_t length);
+
+protected:
+  unsigned long _timeout = 1000;
+  int timedRead();
+  int timedPeek();
+};
+
+// Goes to stdout, setOutput(NULL) to throw it away (e.g. while timing)
+class HardwareSerial : public Stream
+{
+public:
+  void begin(unsigned long baud) {}
+  void setOutput(FILE *output) { _output = output; }
+  size_t write(uint8_t c);
+  size_t write(const uint8_t *buffer, size_t size);
+  int available() { return 0; }
+  int read() { return -1; }
+  int peek() { return -1; }
+
+private:
+  FILE *_output = stdout;
+};
+
+extern HardwareSerial Serial;
+
+#endif
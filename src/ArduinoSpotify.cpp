@@ -19,11 +19,17 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
 */
 
 #include "ArduinoSpotify.h"
+#include "SpotifyAudioFeaturesCache.h"
+#include "SpotifyPipeline.h"
 
 ArduinoSpotify::ArduinoSpotify(Client &client, char *bearerToken)
 {
     this->client = &client;
-    sprintf(this->_bearerToken, "Bearer %s", bearerToken);
+    initAccount(_defaultAccount);
+    setBearerToken(bearerToken);
+    // No refresh token to renew it with
+    autoTokenRefresh = false;
+    _connectedHost[0] = '\0';
 }
 
 ArduinoSpotify::ArduinoSpotify(Client &client, const char *clientId, const char *clientSecret, const char *refreshToken)
@@ -31,60 +37,163 @@ ArduinoSpotify::ArduinoSpotify(Client &client, const char *clientId, const char
     this->client = &client;
     this->_clientId = clientId;
     this->_clientSecret = clientSecret;
-    this->_refreshToken = refreshToken;
+    initAccount(_defaultAccount, refreshToken);
+    _connectedHost[0] = '\0';
 }
 
-int ArduinoSpotify::makeRequestWithBody(const char *type, const char *command, const char *authorization, const char *body, const char *contentType, const char *host)
+void ArduinoSpotify::initAccount(SpotifyAccount &account, const char *refreshToken)
+{
+    memset(&account, 0, sizeof(account));
+    account.refreshToken = refreshToken;
+}
+
+bool ArduinoSpotify::setAccount(SpotifyAccount *account)
+{
+    // A response on its way would be parsed into the wrong account
+    if (isRequestInProgress())
+        {
+            return false;
+        }
+    _account = account != NULL ? account : &_defaultAccount;
+    return true;
+}
+
+SpotifyAccount *ArduinoSpotify::getAccount()
+{
+    return _account;
+}
+
+bool ArduinoSpotify::connectClient(const char *host, bool *reused)
 {
+    *reused = false;
+    if (keepAlive && client->connected() && strcmp(_connectedHost, host) == 0)
+        {
+            if (millis() - _lastActivityTime < keepAliveTimeoutMs)
+                {
+                    // Responses are read exactly to their end, so anything
+                    // else waiting means the connection is in a bad state.
+                    if (!client->available())
+                        {
+                            *reused = true;
+                            return true;
+                        }
+                    SPOTIFY_LOG_DEBUGLN(F("Unexpected data on kept alive connection"));
+                }
+            else
+                {
+                    SPOTIFY_LOG_DEBUGLN(F("Kept alive connection has been idle too long"));
+                }
+        }
+    
+    if (client->connected())
+        {
+            client->stop();
+        }
+    _connectedHost[0] = '\0';
+    
     client->flush();
     client->setTimeout(SPOTIFY_TIMEOUT);
+#ifdef SPOTIFY_STATS
+    unsigned long connectStart = millis();
+#endif
     if (!client->connect(host, portNumber))
         {
-            Serial.println(F("Connection failed"));
+            SPOTIFY_LOG_ERRORLN(F("Connection failed"));
+            return false;
+        }
+#ifdef SPOTIFY_STATS
+    _stats.connectMs = millis() - connectStart;
+    recordFreeHeap();
+#endif
+    
+    strncpy(_connectedHost, host, sizeof(_connectedHost) - 1);
+    _connectedHost[sizeof(_connectedHost) - 1] = '\0';
+    return true;
+}
+
+int ArduinoSpotify::makeRequestWithBody(const char *type, const char *command, const char *authorization, const char *body, const char *contentType, const char *host)
+{
+    finishRequestInProgress();
+    
+    // When reusing a kept alive connection the server may have closed it
+    // since the last request, so we get one more go on a fresh connection.
+    for (int attempt = 0; attempt < 2; attempt++)
+        {
+            bool reused;
+            int sendResult = sendRequestWithBody(type, command, authorization, body, contentType, host, &reused);
+            if (sendResult == -2 && reused) {
+                client->stop();
+                continue;
+            }
+            if (sendResult < 0) {
+                if (sendResult == -2) {
+                    SPOTIFY_LOG_ERRORLN(F("Failed to send request"));
+                }
+                return sendResult;
+            }
+            
+            // These change things (e.g. skip a track), so they are only
+            // sent again if the server closed the connection without
+            // answering. After a timeout it may well have acted on it.
+            int statusCode = getHttpStatusCode();
+            if (statusCode < 0 && reused && _response.getBytesReceived() == 0 && !client->connected()) {
+                SPOTIFY_LOG_INFOLN(F("Kept alive connection dropped, reconnecting"));
+                client->stop();
+                continue;
+            }
+            _lastActivityTime = millis();
+            return statusCode;
+        }
+    
+    return -1;
+}
+
+int ArduinoSpotify::sendRequestWithBody(const char *type, const char *command, const char *authorization, const char *body, const char *contentType, const char *host, bool *reused)
+{
+#ifdef SPOTIFY_STATS
+    startRequestStats();
+#endif
+    if (!connectClient(host, reused))
+        {
             return -1;
         }
     
     // give the esp a breather
     yield();
     
-    // Send HTTP request
-    client->print(type);
-    client->print(command);
-    client->println(F(" HTTP/1.1"));
-    
-    //Headers
-    client->print(F("Host: "));
-    client->println(host);
-    
-    client->println(F("Accept: application/json"));
-    client->print(F("Content-Type: "));
-    client->println(contentType);
+#ifdef SPOTIFY_STATS
+    unsigned long sendStart = millis();
+#endif
     
+    _request.begin(client, type, command, host);
+    _request.addHeader(F("Accept"), "application/json");
+    _request.addHeader(F("Content-Type"), contentType);
     if (authorization != NULL) {
-        client->print(F("Authorization: "));
-        client->println(authorization);
+        _request.addHeader(F("Authorization"), authorization);
     }
+    _request.addHeader(F("Cache-Control"), "no-cache");
+    if (keepAlive) {
+        _request.addHeader(F("Connection"), "keep-alive");
+    }
+    _request.addHeader(F("Content-Length"), (unsigned long)strlen(body));
+    bool sent = _request.send(body);
+    
+#ifdef SPOTIFY_STATS
+    _stats.sendMs = millis() - sendStart;
+    _stats.bytesSent = _request.getBytesSent();
+    _stats.reusedConnection = *reused;
+    recordFreeHeap();
+#endif
     
-    client->println(F("Cache-Control: no-cache"));
-    
-    client->print(F("Content-Length: "));
-    client->println(strlen(body));
-    
-    client->println();
-    
-    client->print(body);
-    
-    if (client->println() == 0) {
-        Serial.println(F("Failed to send request"));
+    if (!sent) {
         return -2;
     }
     
-    int statusCode = getHttpStatusCode();
-    return statusCode;
+    return 0;
 }
 
 int ArduinoSpotify::makePutRequest(const char *command, const char *authorization, const char *body, const char *contentType, const char *host) {
-    return makeRequestWithBody("PUT ", command, authorization, body, contentType);
+    return makeRequestWithBody("PUT ", command, authorization, body, contentType, host);
 }
 
 int ArduinoSpotify::makePostRequest(const char *command, const char *authorization, const char *body, const char *contentType, const char *host)
@@ -92,95 +201,97 @@ int ArduinoSpotify::makePostRequest(const char *command, const char *authorizati
     return makeRequestWithBody("POST ", command, authorization, body, contentType, host);
 }
 
-int ArduinoSpotify::makeGetRequest(const char *command, const char *authorization, const char *accept, const char *host)
+int ArduinoSpotify::makeGetRequest(const char *command, const char *authorization, const char *accept, const char *host, const char *ifNoneMatch)
 {
-    client->flush();
-    client->setTimeout(SPOTIFY_TIMEOUT);
-    if (!client->connect(host, portNumber))
+    finishRequestInProgress();
+    
+    for (int attempt = 0; attempt < 2; attempt++)
+        {
+            bool reused;
+            int sendResult = sendGetRequest(command, authorization, accept, host, &reused, ifNoneMatch);
+            if (sendResult == -2 && reused)
+                {
+                    client->stop();
+                    continue;
+                }
+            if (sendResult < 0)
+                {
+                    if (sendResult == -2)
+                        {
+                            SPOTIFY_LOG_ERRORLN(F("Failed to send request"));
+                        }
+                    return sendResult;
+                }
+            
+            int statusCode = getHttpStatusCode();
+            if (statusCode < 0 && reused)
+                {
+                    SPOTIFY_LOG_INFOLN(F("Kept alive connection dropped, reconnecting"));
+                    client->stop();
+                    continue;
+                }
+            _lastActivityTime = millis();
+            return statusCode;
+        }
+    
+    return -1;
+}
+
+int ArduinoSpotify::sendGetRequest(const char *command, const char *authorization, const char *accept, const char *host, bool *reused, const char *ifNoneMatch)
+{
+#ifdef SPOTIFY_STATS
+    startRequestStats();
+#endif
+    if (!connectClient(host, reused))
         {
-            Serial.println(F("Connection failed"));
             return -1;
         }
     
     // give the esp a breather
     yield();
     
-    // Send HTTP request
-    client->print(F("GET "));
-    client->print(command);
-    client->println(F(" HTTP/1.1"));
-    
-    //Headers
-    client->print(F("Host: "));
-    client->println(host);
-    
-    if (accept != NULL)
-        {
-            client->print(F("Accept: "));
-            client->println(accept);
-        }
+#ifdef SPOTIFY_STATS
+    unsigned long sendStart = millis();
+#endif
     
-    if (authorization != NULL)
-        {
-            client->print(F("Authorization: "));
-            client->println(authorization);
-        }
+    addGetRequest(command, authorization, accept, host, ifNoneMatch);
+    bool sent = _request.send();
     
-    client->println(F("Cache-Control: no-cache"));
+#ifdef SPOTIFY_STATS
+    _stats.sendMs = millis() - sendStart;
+    _stats.bytesSent = _request.getBytesSent();
+    _stats.reusedConnection = *reused;
+    recordFreeHeap();
+#endif
     
-    if (client->println() == 0)
+    if (!sent)
         {
-            Serial.println(F("Failed to send request"));
             return -2;
         }
     
-    int statusCode = getHttpStatusCode();
-    
-    return statusCode;
+    return 0;
 }
 
 void ArduinoSpotify::setRefreshToken(const char *refreshToken)
 {
-    _refreshToken = refreshToken;
+    _account->refreshToken = refreshToken;
 }
 
 bool ArduinoSpotify::refreshAccessToken()
 {
     char body[1000];
-    sprintf(body, refreshAccessTokensBody, _refreshToken, _clientId, _clientSecret);
-    
-#ifdef SPOTIFY_DEBUG
-    Serial.println(body);
-#endif
+    sprintf(body, refreshAccessTokensBody, _account->refreshToken, _clientId, _clientSecret);
     
+    _account->lastTokenRefreshAttempt = millis();
     int statusCode = makePostRequest(SPOTIFY_TOKEN_ENDPOINT, NULL, body, "application/x-www-form-urlencoded", SPOTIFY_ACCOUNTS_HOST);
-    if (statusCode > 0)
-        {
-            skipHeaders();
-        }
     unsigned long now = millis();
     
-#ifdef SPOTIFY_DEBUG
-    Serial.print("status Code");
-    Serial.println(statusCode);
-#endif
+    SPOTIFY_LOG_DEBUG(F("status Code"));
+    SPOTIFY_LOG_DEBUGLN(statusCode);
     
     bool refreshed = false;
     if (statusCode == 200) {
-        DynamicJsonDocument doc(1000);
-        DeserializationError error = deserializeJson(doc, *client);
-        if (!error)
-            {
-                sprintf(this->_bearerToken, "Bearer %s", doc["access_token"].as<char *>());
-#ifdef SPOTIFY_DEBUG
-                Serial.print("Bearer Token: ");
-                Serial.println(this->_bearerToken);
-#endif
-                int tokenTtl = doc["expires_in"];             // Usually 3600 (1 hour)
-                tokenTimeToLiveMs = (tokenTtl * 1000) - 2000; // The 2000 is just to force the token expiry to check if its very close
-                timeTokenRefreshed = now;
-                refreshed = true;
-            }
+        refreshed = parseAccessToken(now);
     }
     else
         {
@@ -191,12 +302,136 @@ bool ArduinoSpotify::refreshAccessToken()
     return refreshed;
 }
 
+bool ArduinoSpotify::parseAccessToken(unsigned long requestTime)
+{
+    DynamicJsonDocument doc(1000);
+#ifdef SPOTIFY_STATS
+    unsigned long parseStart = millis();
+#endif
+    DeserializationError error = deserializeJson(doc, _response);
+#ifdef SPOTIFY_STATS
+    recordParseStats(doc, parseStart);
+#endif
+    if (error)
+        {
+            return false;
+        }
+    
+    if (!setBearerToken(doc["access_token"]))
+        {
+            return false;
+        }
+    setTokenExpiry(doc["expires_in"].as<long>(), requestTime);
+    storeAccessToken(doc["access_token"], doc["expires_in"].as<long>());
+    return true;
+}
+
+void ArduinoSpotify::setTokenStore(SpotifyTokenStore *tokenStore)
+{
+    _account->tokenStore = tokenStore;
+}
+
+bool ArduinoSpotify::loadStoredAccessToken()
+{
+    if (_account->tokenStore == NULL)
+        {
+            return false;
+        }
+    
+    // The stored expiry is a real time, so this only works once the clock
+    // has been set (e.g. configTime() on the ESP boards)
+    unsigned long now = time(NULL);
+    if (now < SPOTIFY_MIN_VALID_TIME)
+        {
+            SPOTIFY_LOG_DEBUGLN(F("Clock not set, can't use the stored token"));
+            return false;
+        }
+    
+    char accessToken[SPOTIFY_STORED_TOKEN_CHAR_LENGTH];
+    unsigned long expiresAt;
+    if (!_account->tokenStore->load(accessToken, sizeof(accessToken), &expiresAt))
+        {
+            return false;
+        }
+    
+    // Not worth using if it would need renewing straight away. Compared
+    // in seconds, as a far off expiry in ms wouldn't fit.
+    if (expiresAt <= now || expiresAt - now <= (tokenRefreshLeadTimeMs + tokenRefreshJitterMs) / 1000)
+        {
+            SPOTIFY_LOG_DEBUGLN(F("Stored token has expired"));
+            return false;
+        }
+    if (expiresAt - now > SPOTIFY_MAX_TOKEN_LIFETIME)
+        {
+            SPOTIFY_LOG_ERRORLN(F("Stored token expires too far ahead, ignoring it"));
+            return false;
+        }
+    
+    if (!setBearerToken(accessToken))
+        {
+            return false;
+        }
+    setTokenExpiry(expiresAt - now, millis());
+    return true;
+}
+
+bool ArduinoSpotify::setBearerToken(const char *accessToken)
+{
+    // Cutting it short would only get 401s back
+    if (accessToken == NULL || strlen(accessToken) >= SPOTIFY_STORED_TOKEN_CHAR_LENGTH)
+        {
+            SPOTIFY_LOG_ERRORLN(F("Access token is missing or too long"));
+            return false;
+        }
+    
+    snprintf(_account->bearerToken, sizeof(_account->bearerToken), "Bearer %s", accessToken);
+    return true;
+}
+
+void ArduinoSpotify::storeAccessToken(const char *accessToken, long expiresInSeconds)
+{
+    if (_account->tokenStore == NULL || accessToken == NULL)
+        {
+            return;
+        }
+    
+    unsigned long now = time(NULL);
+    if (now < SPOTIFY_MIN_VALID_TIME)
+        {
+            return;
+        }
+    
+    if (!_account->tokenStore->save(accessToken, now + expiresInSeconds))
+        {
+            SPOTIFY_LOG_ERRORLN(F("Failed to store the access token"));
+        }
+}
+
+void ArduinoSpotify::setTokenExpiry(long expiresInSeconds, unsigned long refreshTime)
+{
+    // expires_in is usually 3600 (1 hour). The 2000 is just to force the
+    // token expiry to check if its very close
+    _account->tokenTimeToLiveMs = (expiresInSeconds * 1000L) - 2000;
+    _account->timeTokenRefreshed = refreshTime;
+    
+    // Renew it a bit before it runs out, at a slightly random time so a lot
+    // of devices started together don't all hit the accounts server at once
+    unsigned long leadTimeMs = tokenRefreshLeadTimeMs + random(tokenRefreshJitterMs + 1);
+    _account->tokenRefreshDueMs = (_account->tokenTimeToLiveMs > leadTimeMs) ? _account->tokenTimeToLiveMs - leadTimeMs : _account->tokenTimeToLiveMs / 2;
+    _account->lastTokenRefreshAttempt = refreshTime;
+}
+
 bool ArduinoSpotify::checkAndRefreshAccessToken()
 {
-    unsigned long timeSinceLastRefresh = millis() - timeTokenRefreshed;
-    if (timeSinceLastRefresh >= tokenTimeToLiveMs)
+    // A refresh poll() started may be about to give us a new token
+    finishRequestInProgress();
+    
+    // Only once it has actually expired, renewing it early is what
+    // poll() is for so this doesn't hold up a request.
+    unsigned long timeSinceLastRefresh = millis() - _account->timeTokenRefreshed;
+    if (timeSinceLastRefresh >= _account->tokenTimeToLiveMs)
         {
-            Serial.println("Refresh of the Access token is due, doing that now.");
+            SPOTIFY_LOG_INFOLN(F("Refresh of the Access token is due, doing that now."));
             return refreshAccessToken();
         }
     
@@ -204,39 +439,78 @@ bool ArduinoSpotify::checkAndRefreshAccessToken()
     return true;
 }
 
-const char *ArduinoSpotify::requestAccessTokens(const char *code, const char *redirectUrl)
+bool ArduinoSpotify::isTokenRefreshDue()
+{
+    // All done by subtraction so it's still right after millis() wraps
+    unsigned long now = millis();
+    if (now - _account->timeTokenRefreshed < _account->tokenRefreshDueMs)
+        {
+            return false;
+        }
+    
+    // Don't keep hammering the accounts server if it is failing
+    return now - _account->lastTokenRefreshAttempt >= SPOTIFY_TOKEN_RETRY_MS || _account->timeTokenRefreshed == _account->lastTokenRefreshAttempt;
+}
+
+bool ArduinoSpotify::startTokenRefresh()
 {
+    if (_asyncState != spotify_async_idle)
+        {
+            return false;
+        }
     
     char body[1000];
-    sprintf(body, requestAccessTokensBody, code, redirectUrl, _clientId, _clientSecret);
+    sprintf(body, refreshAccessTokensBody, _account->refreshToken, _clientId, _clientSecret);
     
-#ifdef SPOTIFY_DEBUG
-    Serial.println(body);
-#endif
+    SPOTIFY_LOG_DEBUGLN(F("Refreshing the access token in the background"));
     
-    int statusCode = makePostRequest(SPOTIFY_TOKEN_ENDPOINT, NULL, body, "application/x-www-form-urlencoded", SPOTIFY_ACCOUNTS_HOST);
-    if (statusCode > 0)
+    _account->lastTokenRefreshAttempt = millis();
+    bool reused;
+    int sendResult = sendRequestWithBody("POST ", SPOTIFY_TOKEN_ENDPOINT, NULL, body, "application/x-www-form-urlencoded", SPOTIFY_ACCOUNTS_HOST, &reused);
+    if (sendResult == -2 && reused)
+        {
+            client->stop();
+            sendResult = sendRequestWithBody("POST ", SPOTIFY_TOKEN_ENDPOINT, NULL, body, "application/x-www-form-urlencoded", SPOTIFY_ACCOUNTS_HOST, &reused);
+        }
+    
+    if (sendResult < 0)
         {
-            skipHeaders();
+            SPOTIFY_LOG_ERRORLN(F("Failed to send request"));
+            stopClient();
+            return false;
         }
+    
+    waitForAsyncResponse(spotify_async_refresh_token);
+    return true;
+}
+
+const char *ArduinoSpotify::requestAccessTokens(const char *code, const char *redirectUrl)
+{
+    
+    char body[1000];
+    sprintf(body, requestAccessTokensBody, code, redirectUrl, _clientId, _clientSecret);
+    
+    int statusCode = makePostRequest(SPOTIFY_TOKEN_ENDPOINT, NULL, body, "application/x-www-form-urlencoded", SPOTIFY_ACCOUNTS_HOST);
     unsigned long now = millis();
     
-#ifdef SPOTIFY_DEBUG
-    Serial.print("status Code");
-    Serial.println(statusCode);
-#endif
+    SPOTIFY_LOG_DEBUG(F("status Code"));
+    SPOTIFY_LOG_DEBUGLN(statusCode);
     
     if (statusCode == 200)
         {
             DynamicJsonDocument doc(1000);
-            DeserializationError error = deserializeJson(doc, *client);
-            if (!error)
+#ifdef SPOTIFY_STATS
+            unsigned long parseStart = millis();
+#endif
+            DeserializationError error = deserializeJson(doc, _response);
+#ifdef SPOTIFY_STATS
+            recordParseStats(doc, parseStart);
+#endif
+            if (!error && setBearerToken(doc["access_token"]))
                 {
-                    sprintf(this->_bearerToken, "Bearer %s", doc["access_token"].as<char *>());
-                    _refreshToken = doc["refresh_token"].as<char *>();
-                    int tokenTtl = doc["expires_in"];             // Usually 3600 (1 hour)
-                    tokenTimeToLiveMs = (tokenTtl * 1000) - 2000; // The 2000 is just to force the token expiry to check if its very close
-                    timeTokenRefreshed = now;
+                    _account->refreshToken = doc["refresh_token"].as<char *>();
+                    setTokenExpiry(doc["expires_in"].as<long>(), now);
+                    storeAccessToken(doc["access_token"], doc["expires_in"].as<long>());
                 }
         }
     else
@@ -245,100 +519,91 @@ const char *ArduinoSpotify::requestAccessTokens(const char *code, const char *re
         }
     
     closeClient();
-    return _refreshToken;
+    return _account->refreshToken;
 }
 
 bool ArduinoSpotify::play(const char *deviceId)
 {
-    char command[100] = SPOTIFY_PLAY_ENDPOINT;
+    char command[SPOTIFY_PATH_LENGTH] = SPOTIFY_PLAY_ENDPOINT;
     return playerControl(command, deviceId);
 }
 
 bool ArduinoSpotify::playAdvanced(char *body, const char *deviceId)
 {
-    char command[100] = SPOTIFY_PLAY_ENDPOINT;
+    char command[SPOTIFY_PATH_LENGTH] = SPOTIFY_PLAY_ENDPOINT;
     return playerControl(command, deviceId, body);
 }
 
 bool ArduinoSpotify::pause(const char *deviceId)
 {
-    char command[100] = SPOTIFY_PAUSE_ENDPOINT;
+    char command[SPOTIFY_PATH_LENGTH] = SPOTIFY_PAUSE_ENDPOINT;
     return playerControl(command, deviceId);
 }
 
 bool ArduinoSpotify::setVolume(int volume, const char *deviceId)
 {
-    char command[125];
-    sprintf(command, SPOTIFY_VOLUME_ENDPOINT, volume);
+    char command[SPOTIFY_PATH_LENGTH];
+    snprintf(command, sizeof(command), SPOTIFY_VOLUME_ENDPOINT, volume);
     return playerControl(command, deviceId);
 }
 
 bool ArduinoSpotify::toggleShuffle(bool shuffle, const char *deviceId)
 {
-    char command[125];
-    char shuffleState[10];
-    if (shuffle)
-        {
-            strcpy(shuffleState, "true");
-        }
-    else
-        {
-            strcpy(shuffleState, "false");
-        }
-    sprintf(command, SPOTIFY_SHUFFLE_ENDPOINT, shuffleState);
+    char command[SPOTIFY_PATH_LENGTH];
+    snprintf(command, sizeof(command), SPOTIFY_SHUFFLE_ENDPOINT, shuffle ? "true" : "false");
     return playerControl(command, deviceId);
 }
 
 bool ArduinoSpotify::setRepeatMode(RepeatOptions repeat, const char *deviceId)
 {
-    char command[125];
-    char repeatState[10];
+    char command[SPOTIFY_PATH_LENGTH];
+    const char *repeatState;
     switch (repeat)
     {
         case repeat_track:
-            strcpy(repeatState, "track");
+            repeatState = "track";
             break;
         case repeat_context:
-            strcpy(repeatState, "context");
+            repeatState = "context";
             break;
-        case repeat_off:
-            strcpy(repeatState, "off");
+        default:
+            repeatState = "off";
             break;
     }
     
-    sprintf(command, SPOTIFY_REPEAT_ENDPOINT, repeatState);
+    snprintf(command, sizeof(command), SPOTIFY_REPEAT_ENDPOINT, repeatState);
     return playerControl(command, deviceId);
 }
 
-bool ArduinoSpotify::playerControl(char *command, const char *deviceId, const char *body)
+void ArduinoSpotify::addQueryParameter(char *command, size_t size, const char *name, const char *value)
+{
+    // Starts the query string, or adds to it if there already is one
+    size_t length = strlen(command);
+    snprintf(command + length, size - length, "%c%s=%s", strchr(command, '?') == NULL ? '?' : '&', name, value);
+}
+
+void ArduinoSpotify::addDeviceId(char *command, size_t size, const char *deviceId)
 {
     if (deviceId[0] != 0)
         {
-            char *questionMarkPointer;
-            questionMarkPointer = strchr(command, '?');
-            char deviceIdBuff[50];
-            if (questionMarkPointer == NULL)
-                {
-                    sprintf(deviceIdBuff, "?deviceId=%s", deviceId);
-                }
-            else
-                {
-                    // params already started
-                    sprintf(deviceIdBuff, "&deviceId=%s", deviceId);
-                }
-            strcat(command, deviceIdBuff);
+            addQueryParameter(command, size, "device_id", deviceId);
         }
+}
+
+bool ArduinoSpotify::playerControl(char *command, const char *deviceId, const char *body)
+{
+    char path[SPOTIFY_PATH_LENGTH];
+    copyString(path, command, sizeof(path));
+    addDeviceId(path, sizeof(path), deviceId);
     
-#ifdef SPOTIFY_DEBUG
-    Serial.println(command);
-    Serial.println(body);
-#endif
+    SPOTIFY_LOG_DEBUGLN(path);
+    SPOTIFY_LOG_DEBUGLN(body);
     
     if (autoTokenRefresh)
         {
             checkAndRefreshAccessToken();
         }
-    int statusCode = makePutRequest(command, _bearerToken, body);
+    int statusCode = makePutRequest(path, _account->bearerToken, body);
     
     closeClient();
     //Will return 204 if all went well.
@@ -347,22 +612,17 @@ bool ArduinoSpotify::playerControl(char *command, const char *deviceId, const ch
 
 bool ArduinoSpotify::playerNavigate(char *command, const char *deviceId)
 {
-    if (deviceId[0] != 0)
-        {
-            char deviceIdBuff[50];
-            sprintf(deviceIdBuff, "?deviceId=%s", deviceId);
-            strcat(command, deviceIdBuff);
-        }
+    char path[SPOTIFY_PATH_LENGTH];
+    copyString(path, command, sizeof(path));
+    addDeviceId(path, sizeof(path), deviceId);
     
-#ifdef SPOTIFY_DEBUG
-    Serial.println(command);
-#endif
+    SPOTIFY_LOG_DEBUGLN(path);
     
     if (autoTokenRefresh)
         {
             checkAndRefreshAccessToken();
         }
-    int statusCode = makePostRequest(command, _bearerToken);
+    int statusCode = makePostRequest(path, _account->bearerToken);
     
     closeClient();
     //Will return 204 if all went well.
@@ -371,279 +631,1629 @@ bool ArduinoSpotify::playerNavigate(char *command, const char *deviceId)
 
 bool ArduinoSpotify::nextTrack(const char *deviceId)
 {
-    char command[100] = SPOTIFY_NEXT_TRACK_ENDPOINT;
+    char command[SPOTIFY_PATH_LENGTH] = SPOTIFY_NEXT_TRACK_ENDPOINT;
     return playerNavigate(command, deviceId);
 }
 
 bool ArduinoSpotify::previousTrack(const char *deviceId)
 {
-    char command[100] = SPOTIFY_PREVIOUS_TRACK_ENDPOINT;
+    char command[SPOTIFY_PATH_LENGTH] = SPOTIFY_PREVIOUS_TRACK_ENDPOINT;
     return playerNavigate(command, deviceId);
 }
+
 bool ArduinoSpotify::seek(int position, const char *deviceId)
 {
-    char command[100] = SPOTIFY_SEEK_ENDPOINT;
-    char tempBuff[100];
-    sprintf(tempBuff, "?position_ms=%d", position);
-    strcat(command, tempBuff);
-    if (deviceId[0] != 0)
-        {
-            sprintf(tempBuff, "?deviceId=%s", deviceId);
-            strcat(command, tempBuff);
-        }
+    char command[SPOTIFY_PATH_LENGTH] = SPOTIFY_SEEK_ENDPOINT;
+    char positionBuff[12];
+    sprintf(positionBuff, "%d", position);
+    addQueryParameter(command, sizeof(command), "position_ms", positionBuff);
     
-#ifdef SPOTIFY_DEBUG
-    Serial.println(command);
-#endif
-    
-    if (autoTokenRefresh)
-        {
-            checkAndRefreshAccessToken();
-        }
-    int statusCode = makePutRequest(command, _bearerToken);
-    closeClient();
-    //Will return 204 if all went well.
-    return statusCode == 204;
+    // playerControl adds the device ID after the position
+    return playerControl(command, deviceId);
 }
 
-CurrentlyPlaying ArduinoSpotify::getCurrentlyPlaying(const char *market)
+void ArduinoSpotify::addGetRequest(const char *command, const char *authorization, const char *accept, const char *host, const char *ifNoneMatch)
 {
-    char command[100] = SPOTIFY_CURRENTLY_PLAYING_ENDPOINT;
-    if (market[0] != 0)
+    _request.begin(client, "GET ", command, host);
+    if (accept != NULL)
         {
-            char marketBuff[30];
-            sprintf(marketBuff, "?market=%s", market);
-            strcat(command, marketBuff);
+            _request.addHeader(F("Accept"), accept);
         }
-    
-#ifdef SPOTIFY_DEBUG
-    Serial.println(command);
-#endif
-    
-    // Get from https://arduinojson.org/v6/assistant/
-    const size_t bufferSize = currentlyPlayingBufferSize;
-    CurrentlyPlaying currentlyPlaying;
-    // This flag will get cleared if all goes well
-    currentlyPlaying.error = true;
-    if (autoTokenRefresh)
+    if (authorization != NULL)
         {
-            checkAndRefreshAccessToken();
+            _request.addHeader(F("Authorization"), authorization);
+        }
+    _request.addHeader(F("Cache-Control"), "no-cache");
+    if (ifNoneMatch != NULL && ifNoneMatch[0] != '\0')
+        {
+            _request.addHeader(F("If-None-Match"), ifNoneMatch);
+        }
+    if (gzip && !_gzipUnavailable && strcmp(host, SPOTIFY_HOST) == 0)
+        {
+            _request.addHeader(F("Accept-Encoding"), "gzip");
+        }
+    if (keepAlive)
+        {
+            _request.addHeader(F("Connection"), "keep-alive");
+        }
+}
+
+CurrentlyPlaying ArduinoSpotify::getCurrentlyPlaying(const char *market)
+{
+    CurrentlyPlaying currentlyPlaying;
+    memset(&currentlyPlaying, 0, sizeof(currentlyPlaying));
+    // There's no earlier result here for a 304 to refer to
+    requestCurrentlyPlaying(currentlyPlaying, market, false);
+    return currentlyPlaying;
+}
+
+int ArduinoSpotify::getCurrentlyPlaying(processCurrentlyPlaying currentlyPlayingCallback, const char *market)
+{
+    CurrentlyPlaying currentlyPlaying;
+    int statusCode = getCurrentlyPlaying(currentlyPlaying, market);
+    if (statusCode == 200)
+        {
+            currentlyPlayingCallback(currentlyPlaying);
+        }
+    return statusCode;
+}
+
+void ArduinoSpotify::buildCurrentlyPlayingCommand(char *command, size_t size, const char *market)
+{
+    copyString(command, SPOTIFY_CURRENTLY_PLAYING_ENDPOINT, size);
+    if (market[0] != 0)
+        {
+            addQueryParameter(command, size, "market", market);
+        }
+}
+
+int ArduinoSpotify::getCurrentlyPlaying(CurrentlyPlaying &currentlyPlaying, const char *market)
+{
+    return requestCurrentlyPlaying(currentlyPlaying, market, detectCurrentlyPlayingChanges);
+}
+
+int ArduinoSpotify::requestCurrentlyPlaying(CurrentlyPlaying &currentlyPlaying, const char *market, bool detectChanges)
+{
+    char command[SPOTIFY_PATH_LENGTH];
+    buildCurrentlyPlayingCommand(command, sizeof(command), market);
+    
+    SPOTIFY_LOG_DEBUGLN(command);
+    
+    // This flag will get cleared if all goes well
+    currentlyPlaying.error = true;
+    if (autoTokenRefresh)
+        {
+            checkAndRefreshAccessToken();
+        }
+    
+    const char *ifNoneMatch = detectChanges ? _account->currentlyPlayingEtag : NULL;
+    int statusCode = makeGetRequest(command, _account->bearerToken, "application/json", SPOTIFY_HOST, ifNoneMatch);
+    
+    if (statusCode == 200){
+        statusCode = parseCurrentlyPlaying(currentlyPlaying, detectChanges);
+    } else if (statusCode == 304) {
+        // Nothing changed, whatever the caller already has is still correct
+        currentlyPlaying.error = false;
+    }
+    closeClient();
+    return statusCode;
+}
+
+int ArduinoSpotify::parseCurrentlyPlaying(CurrentlyPlaying &currentlyPlaying, bool detectChanges)
+{
+    // Get from https://arduinojson.org/v6/assistant/
+    const size_t bufferSize = currentlyPlayingBufferSize;
+    
+    // Only the fields we copy out are kept, everything else (like the
+    // available_markets arrays) is skipped as it is read off the client.
+    StaticJsonDocument<SPOTIFY_CURRENTLY_PLAYING_FILTER_SIZE> filter;
+    addCurrentlyPlayingFilter(filter);
+    if (filter.overflowed()) {
+        SPOTIFY_LOG_ERRORLN(F("SPOTIFY_CURRENTLY_PLAYING_FILTER_SIZE is too small"));
+        return -1;
+    }
+    
+    // Allocate DynamicJsonDocument
+    DynamicJsonDocument doc(bufferSize);
+    
+    // Parse JSON object
+#ifdef SPOTIFY_STATS
+    unsigned long parseStart = millis();
+#endif
+    DeserializationError error = deserializeJson(doc, getBody(), DeserializationOption::Filter(filter));
+#ifdef SPOTIFY_STATS
+    recordParseStats(doc, parseStart);
+#endif
+    if (error) {
+        SPOTIFY_LOG_ERROR(F("deserializeJson() failed with code "));
+        SPOTIFY_LOG_ERRORLN(error.c_str());
+        return -1;
+    }
+    
+    if (detectChanges) {
+        copyString(_account->currentlyPlayingEtag, _response.getHeader(spotify_header_etag), sizeof(_account->currentlyPlayingEtag));
+        if (!hasCurrentlyPlayingChanged(doc["item"]["uri"], doc["is_playing"].as<bool>(), doc["progress_ms"].as<long>())) {
+            // The caller's copy is still correct, so leave it alone
+            currentlyPlaying.error = false;
+            return 304;
+        }
+    }
+    
+    readCurrentlyPlaying(doc, currentlyPlaying);
+    return 200;
+}
+
+void ArduinoSpotify::addCurrentlyPlayingFilter(JsonDocument &filter)
+{
+    filter["is_playing"] = true;
+    filter["progress_ms"] = true;
+    JsonObject filterItem = filter.createNestedObject("item");
+    filterItem["name"] = true;
+    filterItem["uri"] = true;
+    filterItem["duration_ms"] = true;
+    JsonObject filterAlbum = filterItem.createNestedObject("album");
+    filterAlbum["name"] = true;
+    filterAlbum["uri"] = true;
+    filterAlbum["artists"][0]["name"] = true;
+    filterAlbum["artists"][0]["uri"] = true;
+    filterAlbum["images"][0]["height"] = true;
+    filterAlbum["images"][0]["width"] = true;
+    filterAlbum["images"][0]["url"] = true;
+}
+
+void ArduinoSpotify::readCurrentlyPlaying(JsonDocument &doc, CurrentlyPlaying &currentlyPlaying)
+{
+    JsonObject item = doc["item"];
+    
+    JsonObject firstArtist = item["album"]["artists"][0];
+    
+    copyString(currentlyPlaying.firstArtistName, firstArtist["name"], sizeof(currentlyPlaying.firstArtistName));
+    copyString(currentlyPlaying.firstArtistUri, firstArtist["uri"], sizeof(currentlyPlaying.firstArtistUri));
+    
+    copyString(currentlyPlaying.albumName, item["album"]["name"], sizeof(currentlyPlaying.albumName));
+    copyString(currentlyPlaying.albumUri, item["album"]["uri"], sizeof(currentlyPlaying.albumUri));
+    
+    JsonArray images = item["album"]["images"];
+    
+    // Images are returned in order of width, so last should be smallest.
+    int numImages = images.size();
+    int startingIndex = 0;
+    if (numImages > SPOTIFY_NUM_ALBUM_IMAGES){
+        startingIndex = numImages - SPOTIFY_NUM_ALBUM_IMAGES;
+        currentlyPlaying.numImages = SPOTIFY_NUM_ALBUM_IMAGES;
+    }else{
+        currentlyPlaying.numImages = numImages;
+    }
+    
+    for (int i = 0; i < currentlyPlaying.numImages; i++) {
+        int adjustedIndex = startingIndex + i;
+        currentlyPlaying.albumImages[i].height = images[adjustedIndex]["height"].as<int>();
+        currentlyPlaying.albumImages[i].width = images[adjustedIndex]["width"].as<int>();
+        copyString(currentlyPlaying.albumImages[i].url, images[adjustedIndex]["url"], sizeof(currentlyPlaying.albumImages[i].url));
+    }
+    
+    copyString(currentlyPlaying.trackName, item["name"], sizeof(currentlyPlaying.trackName));
+    copyString(currentlyPlaying.trackUri, item["uri"], sizeof(currentlyPlaying.trackUri));
+    
+    currentlyPlaying.isPlaying = doc["is_playing"].as<bool>();
+    
+    currentlyPlaying.progressMs = doc["progress_ms"].as<long>();
+    currentlyPlaying.duraitonMs = item["duration_ms"].as<long>();
+    
+    currentlyPlaying.error = false;
+}
+
+bool ArduinoSpotify::hasCurrentlyPlayingChanged(const char *trackUri, bool isPlaying, long progressMs)
+{
+    // FNV-1a, only used to tell if the track is different from last time
+    uint32_t trackHash = 2166136261UL;
+    for (const char *c = trackUri; c != NULL && *c != '\0'; c++)
+        {
+            trackHash = (trackHash ^ (uint8_t)*c) * 16777619UL;
+        }
+    
+    unsigned long now = millis();
+    bool changed = true;
+    if (_account->lastTrackHash == trackHash && _account->lastIsPlaying == isPlaying)
+        {
+            // While playing the progress moves on by itself, it only counts
+            // as a change if it isn't roughly where it should be (e.g. a seek)
+            long expectedProgressMs = _account->lastProgressMs;
+            if (isPlaying)
+                {
+                    expectedProgressMs += (long)(now - _account->lastProgressTime);
+                }
+            long drift = progressMs - expectedProgressMs;
+            if (drift < 0)
+                {
+                    drift = -drift;
+                }
+            changed = drift > changeDetectionToleranceMs;
+        }
+    
+    if (changed)
+        {
+            _account->lastTrackHash = trackHash;
+            _account->lastIsPlaying = isPlaying;
+            _account->lastProgressMs = progressMs;
+            _account->lastProgressTime = now;
+        }
+    
+    return changed;
+}
+
+AudioFeatures ArduinoSpotify::getAudioFeatures(const char * uri)
+{
+    AudioFeatures audioFeatures;
+    memset(&audioFeatures, 0, sizeof(audioFeatures));
+    getAudioFeatures(audioFeatures, uri);
+    return audioFeatures;
+}
+
+int ArduinoSpotify::getAudioFeatures(processAudioFeatures audioFeaturesCallback, const char *uri)
+{
+    AudioFeatures audioFeatures;
+    int statusCode = getAudioFeatures(audioFeatures, uri);
+    if (!audioFeatures.error)
+        {
+            audioFeaturesCallback(audioFeatures);
+        }
+    return statusCode;
+}
+
+int ArduinoSpotify::getAudioFeatures(AudioFeatures &audioFeatures, const char *uri)
+{
+    audioFeatures.error = true;
+    
+    const char *trackId = getTrackId(uri);
+    if (trackId == NULL) {
+        SPOTIFY_LOG_DEBUGLN(F("URI invalid"));
+        return -1;
+    }
+    
+    if (_audioFeaturesCache != NULL) {
+        const AudioFeatures *cached = _audioFeaturesCache->get(trackId);
+        if (cached != NULL) {
+            audioFeatures = *cached;
+            return 200;
+        }
+    }
+    
+    char command[SPOTIFY_PATH_LENGTH];
+    snprintf(command, sizeof(command), SPOTIFY_AUDIO_FEATURES_ENDPOINT "/%s", trackId);
+    
+    SPOTIFY_LOG_DEBUGLN(command);
+    
+    if (autoTokenRefresh) {
+        checkAndRefreshAccessToken();
+    }
+    
+    int statusCode = makeGetRequest(command, _account->bearerToken);
+    
+    if (statusCode == 200) {
+        parseAudioFeatures(audioFeatures, trackId);
+    }
+    
+    closeClient();
+    return statusCode;
+}
+
+bool ArduinoSpotify::parseAudioFeatures(AudioFeatures &audioFeatures, const char *trackId)
+{
+    StaticJsonDocument<SPOTIFY_AUDIO_FEATURES_FILTER_SIZE> filter;
+    addAudioFeaturesFilter(filter);
+    if (filter.overflowed()) {
+        SPOTIFY_LOG_ERRORLN(F("SPOTIFY_AUDIO_FEATURES_FILTER_SIZE is too small"));
+        return false;
+    }
+    
+    // Allocate DynamicJsonDocument
+    DynamicJsonDocument doc(audioFeaturesBufferSize);
+    
+    // Parse JSON object
+#ifdef SPOTIFY_STATS
+    unsigned long parseStart = millis();
+#endif
+    DeserializationError error = deserializeJson(doc, getBody(), DeserializationOption::Filter(filter));
+#ifdef SPOTIFY_STATS
+    recordParseStats(doc, parseStart);
+#endif
+    if (error) {
+        SPOTIFY_LOG_ERROR(F("deserializeJson() failed with code "));
+        SPOTIFY_LOG_ERRORLN(error.c_str());
+        return false;
+    }
+    
+    readAudioFeatures(doc, audioFeatures);
+    if (_audioFeaturesCache != NULL && !audioFeatures.error) {
+        _audioFeaturesCache->put(trackId, audioFeatures);
+    }
+    return !audioFeatures.error;
+}
+
+int ArduinoSpotify::getAudioFeatures(const char **uris, int count, processTrackAudioFeatures audioFeaturesCallback)
+{
+    if (autoTokenRefresh) {
+        checkAndRefreshAccessToken();
+    }
+    
+    int statusCode = 200;
+    int index = 0;
+    while (index < count) {
+        char command[sizeof(SPOTIFY_AUDIO_FEATURES_ENDPOINT) + 5 + SPOTIFY_AUDIO_FEATURES_BATCH_SIZE * SPOTIFY_TRACK_ID_CHAR_LENGTH];
+        strcpy(command, SPOTIFY_AUDIO_FEATURES_ENDPOINT "?ids=");
+        const char *batchUris[SPOTIFY_AUDIO_FEATURES_BATCH_SIZE];
+        int batchCount = 0;
+        
+        // Anything that can be answered without asking is passed on
+        // straight away, the rest goes in this request.
+        for (; index < count && batchCount < SPOTIFY_AUDIO_FEATURES_BATCH_SIZE; index++) {
+            const char *trackId = getTrackId(uris[index]);
+            if (trackId == NULL) {
+                failAudioFeatures(&uris[index], 1, audioFeaturesCallback);
+                continue;
+            }
+            
+            const AudioFeatures *cached = _audioFeaturesCache != NULL ? _audioFeaturesCache->get(trackId) : NULL;
+            if (cached != NULL) {
+                AudioFeatures audioFeatures = *cached;
+                audioFeaturesCallback(uris[index], audioFeatures);
+                continue;
+            }
+            
+            // Once a request has failed, the rest aren't asked for
+            if (statusCode != 200) {
+                failAudioFeatures(&uris[index], 1, audioFeaturesCallback);
+                continue;
+            }
+            
+            if (batchCount > 0) {
+                strcat(command, ",");
+            }
+            strcat(command, trackId);
+            batchUris[batchCount++] = uris[index];
+        }
+        
+        if (batchCount > 0) {
+            SPOTIFY_LOG_DEBUGLN(command);
+            statusCode = requestAudioFeatures(command, batchUris, batchCount, audioFeaturesCallback);
+        }
+    }
+    
+    return statusCode;
+}
+
+int ArduinoSpotify::requestAudioFeatures(const char *command, const char **uris, int count, processTrackAudioFeatures audioFeaturesCallback)
+{
+    int statusCode = makeGetRequest(command, _account->bearerToken);
+    int answered = 0;
+    
+    if (statusCode == 200) {
+        StaticJsonDocument<SPOTIFY_AUDIO_FEATURES_FILTER_SIZE> filter;
+        addAudioFeaturesFilter(filter);
+        DynamicJsonDocument doc(audioFeaturesBufferSize);
+        
+        // {"audio_features":[{...},null,...]} is read one track at a time,
+        // so only one is ever in memory. Unknown tracks come back as null.
+#ifdef SPOTIFY_STATS
+        unsigned long parseStart = millis();
+#endif
+        Stream &body = getBody();
+        if (filter.overflowed()) {
+            SPOTIFY_LOG_ERRORLN(F("SPOTIFY_AUDIO_FEATURES_FILTER_SIZE is too small"));
+        } else if (body.find("[")) {
+            for (int i = 0; i < count; i++) {
+                DeserializationError error = deserializeJson(doc, body, DeserializationOption::Filter(filter));
+                if (error) {
+                    SPOTIFY_LOG_ERROR(F("deserializeJson() failed with code "));
+                    SPOTIFY_LOG_ERRORLN(error.c_str());
+                    break;
+                }
+                
+                AudioFeatures audioFeatures;
+                readAudioFeatures(doc, audioFeatures);
+                if (_audioFeaturesCache != NULL && !audioFeatures.error) {
+                    _audioFeaturesCache->put(getTrackId(uris[i]), audioFeatures);
+                }
+                audioFeaturesCallback(uris[i], audioFeatures);
+                answered++;
+                
+                if (!body.findUntil(",", "]")) {
+                    break;
+                }
+            }
+        }
+#ifdef SPOTIFY_STATS
+        recordParseStats(doc, parseStart);
+#endif
+        if (answered < count) {
+            // Cut short or not what we expected
+            statusCode = -1;
+        }
+    }
+    
+    closeClient();
+    failAudioFeatures(&uris[answered], count - answered, audioFeaturesCallback);
+    return statusCode;
+}
+
+void ArduinoSpotify::failAudioFeatures(const char **uris, int count, processTrackAudioFeatures audioFeaturesCallback)
+{
+    AudioFeatures audioFeatures;
+    memset(&audioFeatures, 0, sizeof(audioFeatures));
+    for (int i = 0; i < count; i++) {
+        audioFeatures.error = true;
+        audioFeaturesCallback(uris[i], audioFeatures);
+    }
+}
+
+const char *ArduinoSpotify::getTrackId(const char *uri)
+{
+    const char prefix[] = "spotify:track:";
+    if (uri == NULL || strncmp(uri, prefix, sizeof(prefix) - 1) != 0) {
+        return NULL;
+    }
+    
+    const char *trackId = uri + sizeof(prefix) - 1;
+    size_t length = strlen(trackId);
+    if (length == 0 || length >= SPOTIFY_TRACK_ID_CHAR_LENGTH) {
+        return NULL;
+    }
+    return trackId;
+}
+
+void ArduinoSpotify::setAudioFeaturesCache(SpotifyAudioFeaturesCache *audioFeaturesCache)
+{
+    _audioFeaturesCache = audioFeaturesCache;
+}
+
+void ArduinoSpotify::addAudioFeaturesFilter(JsonDocument &filter)
+{
+    filter["danceability"] = true;
+    filter["energy"] = true;
+    filter["key"] = true;
+    filter["loudness"] = true;
+    filter["mode"] = true;
+    filter["speechiness"] = true;
+    filter["acousticness"] = true;
+    filter["instrumentalness"] = true;
+    filter["liveness"] = true;
+    filter["valence"] = true;
+    filter["tempo"] = true;
+    filter["duration_ms"] = true;
+    filter["time_signature"] = true;
+}
+
+void ArduinoSpotify::readAudioFeatures(JsonDocument &doc, AudioFeatures &audioFeatures)
+{
+    audioFeatures.danceability = doc["danceability"].as<float>();
+    audioFeatures.energy = doc["energy"].as<float>();
+    audioFeatures.key = doc["key"].as<int>();
+    audioFeatures.loudness = doc["loudness"].as<float>();
+    audioFeatures.mode = doc["mode"].as<int>();
+    audioFeatures.speechiness = doc["speechiness"].as<float>();
+    audioFeatures.acousticness = doc["acousticness"].as<float>();
+    audioFeatures.instrumentalness = doc["instrumentalness"].as<float>();
+    audioFeatures.liveness = doc["liveness"].as<float>();
+    audioFeatures.valence = doc["valence"].as<float>();
+    audioFeatures.tempo = doc["tempo"].as<float>();
+    audioFeatures.duration_ms = doc["duration_ms"].as<int>();
+    audioFeatures.time_signature = doc["time_signature"].as<int>();
+    
+    // null for a track Spotify doesn't have features for
+    audioFeatures.error = doc.isNull();
+}
+
+PlayerDetails ArduinoSpotify::getPlayerDetails(const char *market)
+{
+    PlayerDetails playerDetails;
+    memset(&playerDetails, 0, sizeof(playerDetails));
+    getPlayerDetails(playerDetails, market);
+    return playerDetails;
+}
+
+int ArduinoSpotify::getPlayerDetails(processPlayerDetails playerDetailsCallback, const char *market)
+{
+    PlayerDetails playerDetails;
+    int statusCode = getPlayerDetails(playerDetails, market);
+    if (!playerDetails.error)
+        {
+            playerDetailsCallback(playerDetails);
+        }
+    return statusCode;
+}
+
+void ArduinoSpotify::buildPlayerDetailsCommand(char *command, size_t size, const char *market)
+{
+    copyString(command, SPOTIFY_PLAYER_ENDPOINT, size);
+    if (market[0] != 0) {
+        addQueryParameter(command, size, "market", market);
+    }
+}
+
+int ArduinoSpotify::getPlayerDetails(PlayerDetails &playerDetails, const char *market) {
+    char command[SPOTIFY_PATH_LENGTH];
+    buildPlayerDetailsCommand(command, sizeof(command), market);
+    
+    SPOTIFY_LOG_DEBUGLN(command);
+    
+    // This flag will get cleared if all goes well
+    playerDetails.error = true;
+    if (autoTokenRefresh) {
+        checkAndRefreshAccessToken();
+    }
+    
+    int statusCode = makeGetRequest(command, _account->bearerToken);
+    
+    if (statusCode == 200) {
+        parsePlayerDetails(playerDetails);
+    }
+    closeClient();
+    return statusCode;
+}
+
+bool ArduinoSpotify::parsePlayerDetails(PlayerDetails &playerDetails)
+{
+    // Get from https://arduinojson.org/v6/assistant/
+    const size_t bufferSize = playerDetailsBufferSize;
+    
+    // The response also contains the full track item, which we
+    // don't use here, so only keep the player fields.
+    StaticJsonDocument<SPOTIFY_PLAYER_DETAILS_FILTER_SIZE> filter;
+    addPlayerDetailsFilter(filter);
+    if (filter.overflowed()) {
+        SPOTIFY_LOG_ERRORLN(F("SPOTIFY_PLAYER_DETAILS_FILTER_SIZE is too small"));
+        return false;
+    }
+    
+    // Allocate DynamicJsonDocument
+    DynamicJsonDocument doc(bufferSize);
+    
+    // Parse JSON object
+#ifdef SPOTIFY_STATS
+    unsigned long parseStart = millis();
+#endif
+    DeserializationError error = deserializeJson(doc, getBody(), DeserializationOption::Filter(filter));
+#ifdef SPOTIFY_STATS
+    recordParseStats(doc, parseStart);
+#endif
+    if (error) {
+        SPOTIFY_LOG_ERROR(F("deserializeJson() failed with code "));
+        SPOTIFY_LOG_ERRORLN(error.c_str());
+        return false;
+    }
+    
+    readPlayerDetails(doc, playerDetails);
+    return true;
+}
+
+void ArduinoSpotify::addPlayerDetailsFilter(JsonDocument &filter)
+{
+    filter["device"] = true;
+    filter["progress_ms"] = true;
+    filter["is_playing"] = true;
+    filter["shuffle_state"] = true;
+    filter["repeat_state"] = true;
+}
+
+void ArduinoSpotify::readPlayerDetails(JsonDocument &doc, PlayerDetails &playerDetails)
+{
+    JsonObject device = doc["device"];
+    
+    copyString(playerDetails.device.id, device["id"], sizeof(playerDetails.device.id));
+    copyString(playerDetails.device.name, device["name"], sizeof(playerDetails.device.name));
+    copyString(playerDetails.device.type, device["type"], sizeof(playerDetails.device.type));
+    playerDetails.device.isActive = device["is_active"].as<bool>();
+    playerDetails.device.isPrivateSession = device["is_private_session"].as<bool>();
+    playerDetails.device.isRestricted = device["is_restricted"].as<bool>();
+    playerDetails.device.volumePrecent = device["volume_percent"].as<int>();
+    
+    playerDetails.progressMs = doc["progress_ms"].as<long>();
+    playerDetails.isPlaying = doc["is_playing"].as<bool>();
+    
+    playerDetails.shuffleState = doc["shuffle_state"].as<bool>();
+    
+    const char *repeat_state = doc["repeat_state"] | "off";
+    
+    if (strncmp(repeat_state, "track", 5) == 0) {    playerDetails.repeateState = repeat_track;
+    }
+    else if (strncmp(repeat_state, "context", 7) == 0) {    playerDetails.repeateState = repeat_context;
+    }
+    else {    playerDetails.repeateState = repeat_off;
+    }
+    
+    playerDetails.error = false;
+}
+
+int ArduinoSpotify::getPlayerSnapshot(PlayerSnapshot &snapshot, const char *market, bool withAudioFeatures)
+{
+    char command[SPOTIFY_PATH_LENGTH];
+    buildPlayerDetailsCommand(command, sizeof(command), market);
+    
+    SPOTIFY_LOG_DEBUGLN(command);
+    
+    // This flag will get cleared if all goes well
+    snapshot.error = true;
+    snapshot.audioFeaturesUpdated = false;
+    if (autoTokenRefresh) {
+        checkAndRefreshAccessToken();
+    }
+    
+    // The audio features in the snapshot belong to this track
+    char previousTrackUri[SPOTIFY_URI_CHAR_LENGTH];
+    copyString(previousTrackUri, snapshot.currentlyPlaying.trackUri, sizeof(previousTrackUri));
+    
+    int statusCode = makeGetRequest(command, _account->bearerToken);
+    
+    if (statusCode == 200) {
+        parsePlayerSnapshot(snapshot);
+    }
+    closeClient();
+    
+    if (snapshot.error || !withAudioFeatures || snapshot.currentlyPlaying.trackUri[0] == '\0') {
+        return statusCode;
+    }
+    
+    if (snapshot.audioFeatures.error || strcmp(previousTrackUri, snapshot.currentlyPlaying.trackUri) != 0) {
+        getAudioFeatures(snapshot.audioFeatures, snapshot.currentlyPlaying.trackUri);
+        snapshot.audioFeaturesUpdated = !snapshot.audioFeatures.error;
+    }
+    return statusCode;
+}
+
+bool ArduinoSpotify::parsePlayerSnapshot(PlayerSnapshot &snapshot)
+{
+    // /v1/me/player has the same track fields as currently-playing, so
+    // both results come out of the one document.
+    StaticJsonDocument<SPOTIFY_PLAYER_SNAPSHOT_FILTER_SIZE> filter;
+    addCurrentlyPlayingFilter(filter);
+    addPlayerDetailsFilter(filter);
+    if (filter.overflowed()) {
+        SPOTIFY_LOG_ERRORLN(F("SPOTIFY_PLAYER_SNAPSHOT_FILTER_SIZE is too small"));
+        return false;
+    }
+    
+    DynamicJsonDocument doc(playerSnapshotBufferSize);
+    
+#ifdef SPOTIFY_STATS
+    unsigned long parseStart = millis();
+#endif
+    DeserializationError error = deserializeJson(doc, getBody(), DeserializationOption::Filter(filter));
+#ifdef SPOTIFY_STATS
+    recordParseStats(doc, parseStart);
+#endif
+    if (error) {
+        SPOTIFY_LOG_ERROR(F("deserializeJson() failed with code "));
+        SPOTIFY_LOG_ERRORLN(error.c_str());
+        return false;
+    }
+    
+    readPlayerDetails(doc, snapshot.playerDetails);
+    readCurrentlyPlaying(doc, snapshot.currentlyPlaying);
+    snapshot.error = false;
+    return true;
+}
+
+int ArduinoSpotify::sendPipeline(SpotifyPipeline &pipeline)
+{
+    finishRequestInProgress();
+    if (autoTokenRefresh)
+        {
+            checkAndRefreshAccessToken();
+        }
+    
+    // Cached audio features are passed on straight away, the rest are sent
+    int count = pipeline.getCount();
+    bool pending[SPOTIFY_PIPELINE_SIZE];
+    int pendingCount = 0;
+    int answered = 0;
+    for (int i = 0; i < count; i++)
+        {
+            SpotifyPipelinedRequest *request = pipeline.getRequest(i);
+            request->statusCode = -1;
+            pending[i] = true;
+            if (request->type == spotify_pipelined_audio_features)
+                {
+                    const char *trackId = getTrackId(request->argument);
+                    const AudioFeatures *cached = (trackId != NULL && _audioFeaturesCache != NULL) ? _audioFeaturesCache->get(trackId) : NULL;
+                    if (trackId == NULL)
+                        {
+                            SPOTIFY_LOG_DEBUGLN(F("URI invalid"));
+                            pending[i] = false;
+                        }
+                    else if (cached != NULL)
+                        {
+                            AudioFeatures audioFeatures = *cached;
+                            request->statusCode = 200;
+                            request->audioFeaturesCallback(audioFeatures);
+                            pending[i] = false;
+                            answered++;
+                        }
+                }
+            if (pending[i])
+                {
+                    pendingCount++;
+                }
+        }
+    
+    if (pendingCount == 0)
+        {
+            return answered;
+        }
+    
+    // The server can close the connection after any response, without
+    // looking at the requests behind it, so each round sends whatever
+    // hasn't been answered yet. It gives up once a round on a new
+    // connection gets nothing back.
+    while (pendingCount > 0)
+        {
+            bool reused;
+            int sendResult = sendPipelinedRequests(pipeline, pending, &reused);
+            if (sendResult == -2 && reused)
+                {
+                    client->stop();
+                    continue;
+                }
+            if (sendResult < 0)
+                {
+                    if (sendResult == -2)
+                        {
+                            SPOTIFY_LOG_ERRORLN(F("Failed to send request"));
+                        }
+                    break;
+                }
+            
+            int roundAnswered = 0;
+            for (int i = 0; i < count; i++)
+                {
+                    if (!pending[i])
+                        {
+                            continue;
+                        }
+                    
+                    int statusCode = getHttpStatusCode();
+                    if (statusCode < 0)
+                        {
+                            break;
+                        }
+                    pending[i] = false;
+                    pendingCount--;
+                    answered++;
+                    roundAnswered++;
+                    pipeline.getRequest(i)->statusCode = readPipelinedResponse(pipeline, i, statusCode);
+                    _lastActivityTime = millis();
+                    
+                    // The next response starts where this one ends
+                    if (!_response.skipBody() || !_response.canReuseConnection())
+                        {
+                            break;
+                        }
+                }
+            
+            if (pendingCount > 0)
+                {
+                    if (roundAnswered == 0 && !reused)
+                        {
+                            break;
+                        }
+                    SPOTIFY_LOG_INFOLN(F("Pipelined connection closed early, sending the rest again"));
+                    client->stop();
+                }
+        }
+    
+    closeClient();
+    return answered;
+}
+
+int ArduinoSpotify::sendPipelinedRequests(SpotifyPipeline &pipeline, bool *pending, bool *reused)
+{
+#ifdef SPOTIFY_STATS
+    startRequestStats();
+#endif
+    if (!connectClient(SPOTIFY_HOST, reused))
+        {
+            return -1;
+        }
+    
+    // give the esp a breather
+    yield();
+    
+#ifdef SPOTIFY_STATS
+    unsigned long sendStart = millis();
+#endif
+    
+    int last = -1;
+    for (int i = 0; i < pipeline.getCount(); i++)
+        {
+            if (pending[i])
+                {
+                    last = i;
+                }
+        }
+    
+    // The requests are held in the request buffer one after another and
+    // written out together, rather than waiting for each response.
+    bool sent = true;
+    for (int i = 0; i <= last; i++)
+        {
+            if (!pending[i])
+                {
+                    continue;
+                }
+            
+            SpotifyPipelinedRequest *request = pipeline.getRequest(i);
+            char command[SPOTIFY_PATH_LENGTH];
+            const char *ifNoneMatch = NULL;
+            switch (request->type)
+                {
+                    case spotify_pipelined_currently_playing:
+                        buildCurrentlyPlayingCommand(command, sizeof(command), request->argument);
+                        ifNoneMatch = detectCurrentlyPlayingChanges ? _account->currentlyPlayingEtag : NULL;
+                        break;
+                    case spotify_pipelined_player_details:
+                        buildPlayerDetailsCommand(command, sizeof(command), request->argument);
+                        break;
+                    case spotify_pipelined_audio_features:
+                        snprintf(command, sizeof(command), SPOTIFY_AUDIO_FEATURES_ENDPOINT "/%s", getTrackId(request->argument));
+                        break;
+                    case spotify_pipelined_get:
+                        copyString(command, request->argument, sizeof(command));
+                        break;
+                }
+            
+            SPOTIFY_LOG_DEBUGLN(command);
+            addGetRequest(command, _account->bearerToken, "application/json", SPOTIFY_HOST, ifNoneMatch);
+            if (i < last)
+                {
+                    _request.hold();
+                }
+            else
+                {
+                    sent = _request.send();
+                }
         }
     
-    int statusCode = makeGetRequest(command, _bearerToken);
-    if (statusCode > 0){
-        skipHeaders();
-    }
+#ifdef SPOTIFY_STATS
+    _stats.sendMs = millis() - sendStart;
+    _stats.bytesSent = _request.getBytesSent();
+    _stats.reusedConnection = *reused;
+    recordFreeHeap();
+#endif
     
-    if (statusCode == 200){
-        // Allocate DynamicJsonDocument
-        DynamicJsonDocument doc(bufferSize);
-        
-        // Parse JSON object
-        DeserializationError error = deserializeJson(doc, *client);
-        if (!error){
-            JsonObject item = doc["item"];
-            JsonObject firstArtist = item["album"]["artists"][0];
-            
-            currentlyPlaying.firstArtistName = (char *)firstArtist["name"].as<char *>();
-            currentlyPlaying.firstArtistUri = (char *)firstArtist["uri"].as<char *>();
+    if (!sent)
+        {
+            return -2;
+        }
+    
+    return 0;
+}
+
+int ArduinoSpotify::readPipelinedResponse(SpotifyPipeline &pipeline, int index, int statusCode)
+{
+    SpotifyPipelinedRequest *request = pipeline.getRequest(index);
+    switch (request->type)
+        {
+            case spotify_pipelined_currently_playing:
+                {
+                    if (statusCode == 200)
+                        {
+                            CurrentlyPlaying currentlyPlaying;
+                            statusCode = parseCurrentlyPlaying(currentlyPlaying, detectCurrentlyPlayingChanges);
+                            if (statusCode == 200)
+                                {
+                                    request->currentlyPlayingCallback(currentlyPlaying);
+                                }
+                        }
+                    break;
+                }
+            case spotify_pipelined_player_details:
+                {
+                    PlayerDetails playerDetails;
+                    if (statusCode == 200 && !parsePlayerDetails(playerDetails))
+                        {
+                            statusCode = -1;
+                        }
+                    if (statusCode == 200)
+                        {
+                            request->playerDetailsCallback(playerDetails);
+                        }
+                    break;
+                }
+            case spotify_pipelined_audio_features:
+                {
+                    AudioFeatures audioFeatures;
+                    if (statusCode == 200 && !parseAudioFeatures(audioFeatures, getTrackId(request->argument)))
+                        {
+                            statusCode = -1;
+                        }
+                    if (statusCode == 200)
+                        {
+                            request->audioFeaturesCallback(audioFeatures);
+                        }
+                    break;
+                }
+            case spotify_pipelined_get:
+                request->responseCallback(statusCode, getBody());
+                break;
+        }
+    return statusCode;
+}
+
+int ArduinoSpotify::getPlaylistTracks(const char *playlistId, processTrack trackCallback, int offset, int count, const char *market)
+{
+    char command[SPOTIFY_PAGING_PATH_LENGTH];
+    snprintf(command, sizeof(command), SPOTIFY_PLAYLIST_TRACKS_ENDPOINT, playlistId);
+    addQueryParameter(command, sizeof(command), "fields", SPOTIFY_PAGED_TRACK_FIELDS);
+    if (market[0] != 0)
+        {
+            addQueryParameter(command, sizeof(command), "market", market);
+        }
+    return getPagedTracks(command, "items", true, true, trackCallback, offset, count);
+}
+
+int ArduinoSpotify::getSavedTracks(processTrack trackCallback, int offset, int count, const char *market)
+{
+    char command[SPOTIFY_PAGING_PATH_LENGTH];
+    copyString(command, SPOTIFY_SAVED_TRACKS_ENDPOINT, sizeof(command));
+    if (market[0] != 0)
+        {
+            addQueryParameter(command, sizeof(command), "market", market);
+        }
+    return getPagedTracks(command, "items", true, true, trackCallback, offset, count);
+}
+
+int ArduinoSpotify::getQueue(processTrack trackCallback)
+{
+    // Not paged, it's only ever the next few tracks
+    return getPagedTracks(SPOTIFY_QUEUE_ENDPOINT, "queue", false, false, trackCallback, 0, -1);
+}
+
+int ArduinoSpotify::getPagingTotal()
+{
+    return _pagingTotal;
+}
+
+int ArduinoSpotify::getPagedTracks(const char *command, const char *itemsKey, bool wrapped, bool paged, processTrack trackCallback, int offset, int count)
+{
+    _pagingTotal = -1;
+    if (offset < 0)
+        {
+            SPOTIFY_LOG_ERRORLN(F("The offset can't be negative"));
+            return -1;
+        }
+    if (count == 0)
+        {
+            // Spotify rejects limit=0, and there's nothing to ask for anyway
+            return 200;
+        }
+    
+    if (autoTokenRefresh)
+        {
+            checkAndRefreshAccessToken();
+        }
+    
+    int index = offset;
+    int statusCode = -1;
+    // Whether the request for the page at index has already been sent
+    bool requested = false;
+    char path[SPOTIFY_PAGING_PATH_LENGTH];
+    for (;;)
+        {
+            int limit = (count >= 0 && offset + count - index < pagingLimit) ? offset + count - index : pagingLimit;
+            if (requested)
+                {
+                    statusCode = getHttpStatusCode();
+                    if (statusCode < 0)
+                        {
+                            SPOTIFY_LOG_INFOLN(F("Prefetched page didn't arrive, asking again"));
+                            stopClient();
+                            requested = false;
+                        }
+                }
+            if (!requested)
+                {
+                    if (paged)
+                        {
+                            buildPagePath(path, sizeof(path), command, index, limit);
+                        }
+                    else
+                        {
+                            copyString(path, command, sizeof(path));
+                        }
+                    SPOTIFY_LOG_DEBUGLN(path);
+                    statusCode = makeGetRequest(path, _account->bearerToken);
+                }
+            if (statusCode != 200)
+                {
+                    break;
+                }
             
-            currentlyPlaying.albumName = (char *)item["album"]["name"].as<char *>();
-            currentlyPlaying.albumUri = (char *)item["album"]["uri"].as<char *>();
+            // The response to this goes out right behind the current one,
+            // so it's on its way while the current one is being read
+            int nextIndex = index + limit;
+            bool prefetched = false;
+            if (paged && prefetchPages && _pagingTotal >= 0 && nextIndex < _pagingTotal && (count < 0 || nextIndex < offset + count))
+                {
+                    int nextLimit = (count >= 0 && offset + count - nextIndex < pagingLimit) ? offset + count - nextIndex : pagingLimit;
+                    buildPagePath(path, sizeof(path), command, nextIndex, nextLimit);
+                    SPOTIFY_LOG_DEBUGLN(path);
+                    addGetRequest(path, _account->bearerToken, "application/json", SPOTIFY_HOST, NULL);
+                    prefetched = _request.send();
+                }
             
-            JsonArray images = item["album"]["images"];
+            int trackCount = 0;
+            bool hasNext = false;
+            bool stopped = false;
+            if (!readTrackPage(getBody(), itemsKey, wrapped, trackCallback, index, paged ? -1 : count, &trackCount, &hasNext, &stopped))
+                {
+                    statusCode = -1;
+                    stopped = true;
+                }
+            index += trackCount;
+            if (!paged)
+                {
+                    _pagingTotal = trackCount;
+                }
             
-            // Images are returned in order of width, so last should be smallest.
-            int numImages = images.size();
-            int startingIndex = 0;
-            if (numImages > SPOTIFY_NUM_ALBUM_IMAGES){
-                startingIndex = numImages - SPOTIFY_NUM_ALBUM_IMAGES;
-                currentlyPlaying.numImages = SPOTIFY_NUM_ALBUM_IMAGES;
-            }else{
-                currentlyPlaying.numImages = numImages;
-            }
+            if (stopped || !hasNext || trackCount == 0 || (count >= 0 && index >= offset + count))
+                {
+                    if (prefetched)
+                        {
+                            // Its response isn't wanted
+                            stopClient();
+                        }
+                    break;
+                }
             
-            for (int i = 0; i < numImages; i++) {
-                int adjustedIndex = startingIndex + i;
-                currentlyPlaying.albumImages[i].height = images[adjustedIndex]["height"].as<int>();
-                currentlyPlaying.albumImages[i].width = images[adjustedIndex]["width"].as<int>();
-                currentlyPlaying.albumImages[i].url = (char *)images[adjustedIndex]["url"].as<char *>();
-            }
+            // The prefetched page is only the right one if this page was
+            // full, and can only be read if this response ended cleanly
+            requested = prefetched && trackCount == limit && _response.skipBody() && _response.canReuseConnection();
+            if (requested)
+                {
+                    _lastActivityTime = millis();
+                }
+            else if (prefetched)
+                {
+                    stopClient();
+                }
+            else
+                {
+                    closeClient();
+                }
+        }
+    
+    closeClient();
+    return statusCode;
+}
+
+void ArduinoSpotify::buildPagePath(char *path, size_t size, const char *command, int offset, int limit)
+{
+    char value[12];
+    copyString(path, command, size);
+    snprintf(value, sizeof(value), "%d", limit);
+    addQueryParameter(path, size, "limit", value);
+    snprintf(value, sizeof(value), "%d", offset);
+    addQueryParameter(path, size, "offset", value);
+}
+
+bool ArduinoSpotify::readTrackPage(Stream &body, const char *itemsKey, bool wrapped, processTrack trackCallback, int index, int maxTracks, int *trackCount, bool *hasNext, bool *stopped)
+{
+    // A page can be far too big to parse in one go, so the outer object
+    // is walked here a key at a time and only the tracks are parsed, one
+    // by one. Its other keys can come in any order.
+    if (peekJson(body) != '{')
+        {
+            return false;
+        }
+    body.read();
+    
+    for (;;)
+        {
+            int c = peekJson(body);
+            body.read();
+            if (c == '}')
+                {
+                    return true;
+                }
+            if (c == ',')
+                {
+                    continue;
+                }
             
-            currentlyPlaying.trackName = (char *)item["name"].as<char *>();
-            currentlyPlaying.trackUri = (char *)item["uri"].as<char *>();
+            char key[16];
+            if (c != '"' || !readJsonString(body, key, sizeof(key)) || peekJson(body) != ':')
+                {
+                    return false;
+                }
+            body.read();
             
-            currentlyPlaying.isPlaying = doc["is_playing"].as<bool>();
+            if (strcmp(key, itemsKey) == 0 && peekJson(body) == '[')
+                {
+                    if (!readTracks(body, wrapped, trackCallback, index, maxTracks, trackCount, stopped))
+                        {
+                            return false;
+                        }
+                    if (*stopped)
+                        {
+                            // Nothing else is needed, what's left gets skipped
+                            return true;
+                        }
+                }
+            else if (strcmp(key, "next") == 0)
+                {
+                    // null on the last page
+                    *hasNext = peekJson(body) == '"';
+                    if (!skipJsonValue(body, NULL, 0))
+                        {
+                            return false;
+                        }
+                }
+            else if (strcmp(key, "total") == 0)
+                {
+                    char total[12];
+                    if (!skipJsonValue(body, total, sizeof(total)))
+                        {
+                            return false;
+                        }
+                    _pagingTotal = atoi(total);
+                }
+            else if (!skipJsonValue(body, NULL, 0))
+                {
+                    return false;
+                }
+        }
+}
+
+bool ArduinoSpotify::readTracks(Stream &body, bool wrapped, processTrack trackCallback, int index, int maxTracks, int *trackCount, bool *stopped)
+{
+    // Playlists and saved tracks wrap each track with when it was added,
+    // the queue is just the tracks
+    StaticJsonDocument<SPOTIFY_PAGED_TRACK_FILTER_SIZE> filter;
+    JsonObject filterTrack = wrapped ? filter.createNestedObject("track") : filter.to<JsonObject>();
+    filterTrack["name"] = true;
+    filterTrack["uri"] = true;
+    filterTrack["duration_ms"] = true;
+    filterTrack["artists"][0]["name"] = true;
+    if (filter.overflowed())
+        {
+            SPOTIFY_LOG_ERRORLN(F("SPOTIFY_PAGED_TRACK_FILTER_SIZE is too small"));
+            return false;
+        }
+    
+    DynamicJsonDocument doc(pagedTrackBufferSize);
+    
+    body.read();
+    if (peekJson(body) == ']')
+        {
+            body.read();
+            return true;
+        }
+    
+    for (;;)
+        {
+            DeserializationError error = deserializeJson(doc, body, DeserializationOption::Filter(filter));
+            if (error)
+                {
+                    SPOTIFY_LOG_ERROR(F("deserializeJson() failed with code "));
+                    SPOTIFY_LOG_ERRORLN(error.c_str());
+                    return false;
+                }
             
-            currentlyPlaying.progressMs = doc["progress_ms"].as<long>();
-            currentlyPlaying.duraitonMs = item["duration_ms"].as<long>();
+            JsonObject item = wrapped ? doc["track"] : doc.as<JsonObject>();
+            SpotifyTrack track;
+            copyString(track.trackName, item["name"], sizeof(track.trackName));
+            copyString(track.trackUri, item["uri"], sizeof(track.trackUri));
+            copyString(track.firstArtistName, item["artists"][0]["name"], sizeof(track.firstArtistName));
+            track.durationMs = item["duration_ms"].as<long>();
+            track.error = item.isNull();
             
+            (*trackCount)++;
+            if (!trackCallback(track, index++) || (maxTracks >= 0 && *trackCount >= maxTracks))
+                {
+                    *stopped = true;
+                    return true;
+                }
             
-            currentlyPlaying.error = false;
-        } else {
-            Serial.print(F("deserializeJson() failed with code "));
-            Serial.println(error.c_str());
+            int c = peekJson(body);
+            body.read();
+            if (c == ']')
+                {
+                    return true;
+                }
+            if (c != ',')
+                {
+                    return false;
+                }
         }
-    }
-    closeClient();
-    return currentlyPlaying;
 }
 
-AudioFeatures ArduinoSpotify::getAudioFeatures(const char * uri)
+int ArduinoSpotify::waitForJson(Stream &body)
+{
+    // The next character without taking it, -1 if it doesn't come in time
+    // or the body has ended
+    unsigned long lastDataTime = millis();
+    while (millis() - lastDataTime < SPOTIFY_TIMEOUT)
+        {
+            int c = body.peek();
+            if (c >= 0)
+                {
+                    return c;
+                }
+            if (&body == &_gzipStream && _gzipStream.isFinished())
+                {
+                    break;
+                }
+            yield();
+        }
+    return -1;
+}
+
+int ArduinoSpotify::peekJson(Stream &body)
+{
+    // The next character that isn't whitespace, without taking it
+    int c;
+    while ((c = waitForJson(body)) >= 0)
+        {
+            if (c != ' ' && c != '\n' && c != '\r' && c != '\t')
+                {
+                    return c;
+                }
+            body.read();
+        }
+    return -1;
+}
+
+int ArduinoSpotify::readJsonChar(Stream &body)
+{
+    int c = waitForJson(body);
+    if (c >= 0)
+        {
+            body.read();
+        }
+    return c;
+}
+
+bool ArduinoSpotify::readJsonString(Stream &body, char *value, size_t size)
+{
+    // The opening quote has already been read. Anything that doesn't fit
+    // is dropped, and escapes are only handled enough to find the end.
+    size_t length = 0;
+    int c;
+    while ((c = readJsonChar(body)) >= 0)
+        {
+            if (c == '"')
+                {
+                    if (value != NULL)
+                        {
+                            value[length] = '\0';
+                        }
+                    return true;
+                }
+            if (c == '\\' && (c = readJsonChar(body)) < 0)
+                {
+                    break;
+                }
+            if (value != NULL && length < size - 1)
+                {
+                    value[length++] = c;
+                }
+        }
+    return false;
+}
+
+bool ArduinoSpotify::skipJsonValue(Stream &body, char *value, size_t size)
+{
+    int c = peekJson(body);
+    if (c == '"')
+        {
+            body.read();
+            return readJsonString(body, value, size);
+        }
+    
+    if (c == '{' || c == '[')
+        {
+            // Objects and arrays are read to their matching end
+            int depth = 0;
+            int b;
+            while ((b = readJsonChar(body)) >= 0)
+                {
+                    if (b == '"')
+                        {
+                            if (!readJsonString(body, NULL, 0))
+                                {
+                                    return false;
+                                }
+                        }
+                    else if (b == '{' || b == '[')
+                        {
+                            depth++;
+                        }
+                    else if ((b == '}' || b == ']') && --depth == 0)
+                        {
+                            return true;
+                        }
+                }
+            return false;
+        }
+    
+    // A number, true, false or null, which ends at whatever comes next
+    size_t length = 0;
+    while (c >= 0 && c != ',' && c != '}' && c != ']')
+        {
+            body.read();
+            if (value != NULL && length < size - 1)
+                {
+                    value[length++] = c;
+                }
+            c = peekJson(body);
+        }
+    if (value != NULL)
+        {
+            value[length] = '\0';
+        }
+    return length > 0 || value == NULL;
+}
+
+bool ArduinoSpotify::startCurrentlyPlaying(processCurrentlyPlaying currentlyPlayingCallback, const char *market)
+{
+    char command[SPOTIFY_PATH_LENGTH];
+    buildCurrentlyPlayingCommand(command, sizeof(command), market);
+    if (!startAsyncRequest(command, spotify_async_currently_playing))
+        {
+            return false;
+        }
+    
+    _asyncCurrentlyPlayingCallback = currentlyPlayingCallback;
+    return true;
+}
+
+bool ArduinoSpotify::startPlayerDetails(processPlayerDetails playerDetailsCallback, const char *market)
+{
+    char command[SPOTIFY_PATH_LENGTH];
+    buildPlayerDetailsCommand(command, sizeof(command), market);
+    if (!startAsyncRequest(command, spotify_async_player_details))
+        {
+            return false;
+        }
+    
+    _asyncPlayerDetailsCallback = playerDetailsCallback;
+    return true;
+}
+
+bool ArduinoSpotify::isRequestInProgress()
+{
+    return _asyncState != spotify_async_idle;
+}
+
+int ArduinoSpotify::getAsyncStatusCode()
+{
+    return _asyncStatusCode;
+}
+
+int ArduinoSpotify::getPlayerCommandStatusCode()
+{
+    return _playerCommandStatusCode;
+}
+
+bool ArduinoSpotify::startPlayerCommand(const char *method, const char *command, const char *deviceId, const char *body)
+{
+    if (_asyncState != spotify_async_idle)
+        {
+            SPOTIFY_LOG_DEBUGLN(F("Request already in progress"));
+            return false;
+        }
+    
+    char fullCommand[SPOTIFY_PATH_LENGTH];
+    copyString(fullCommand, command, sizeof(fullCommand));
+    addDeviceId(fullCommand, sizeof(fullCommand), deviceId);
+    
+    SPOTIFY_LOG_DEBUGLN(fullCommand);
+    
+    if (autoTokenRefresh)
+        {
+            checkAndRefreshAccessToken();
+        }
+    
+    bool reused;
+    int sendResult = sendRequestWithBody(method, fullCommand, _account->bearerToken, body, "application/json", SPOTIFY_HOST, &reused);
+    if (sendResult == -2 && reused)
+        {
+            client->stop();
+            sendResult = sendRequestWithBody(method, fullCommand, _account->bearerToken, body, "application/json", SPOTIFY_HOST, &reused);
+        }
+    
+    if (sendResult < 0)
+        {
+            SPOTIFY_LOG_ERRORLN(F("Failed to send request"));
+            _asyncStatusCode = -1;
+            stopClient();
+            return false;
+        }
+    
+    waitForAsyncResponse(spotify_async_player_command);
+    return true;
+}
+
+bool ArduinoSpotify::startAsyncRequest(const char *command, SpotifyAsyncRequestType requestType)
 {
-    AudioFeatures audioFeatures;
-    audioFeatures.error = true;
+    if (_asyncState != spotify_async_idle)
+        {
+            SPOTIFY_LOG_DEBUGLN(F("Request already in progress"));
+            return false;
+        }
     
-    const char check[] = "spotify:track:";
+    SPOTIFY_LOG_DEBUGLN(command);
     
-    char command[200] = SPOTIFY_AUDIO_FEATURES_ENDPOINT;
-    strcat(command, "/");
+    if (autoTokenRefresh)
+        {
+            checkAndRefreshAccessToken();
+        }
     
-    char id[50];
-    strcpy(id, uri);
-    int i = 0;
-    for(; i < 14; i++){
-        if(id[i] != check[i]){
-#ifdef SPOTIFY_DEBUG
-            Serial.println("URI invalid");
-#endif
-            return audioFeatures;
+    // Connecting and sending still block, it's waiting on the server
+    // and reading the response that poll() takes care of.
+    const char *ifNoneMatch = (detectCurrentlyPlayingChanges && requestType == spotify_async_currently_playing) ? _account->currentlyPlayingEtag : NULL;
+    bool reused;
+    int sendResult = sendGetRequest(command, _account->bearerToken, "application/json", SPOTIFY_HOST, &reused, ifNoneMatch);
+    if (sendResult == -2 && reused)
+        {
+            client->stop();
+            sendResult = sendGetRequest(command, _account->bearerToken, "application/json", SPOTIFY_HOST, &reused, ifNoneMatch);
         }
-    }
     
+    if (sendResult < 0)
+        {
+            SPOTIFY_LOG_ERRORLN(F("Failed to send request"));
+            stopClient();
+            return false;
+        }
     
-#ifdef SPOTIFY_DEBUG
-    Serial.println("URI valid");
-#endif
+    waitForAsyncResponse(requestType);
+    return true;
+}
+
+void ArduinoSpotify::waitForAsyncResponse(SpotifyAsyncRequestType requestType)
+{
+    _asyncRequestType = requestType;
+    _asyncState = spotify_async_headers;
+    _asyncInBackground = false;
+    _asyncStatusCode = -1;
+    _response.begin(client, SPOTIFY_TIMEOUT);
+    _asyncLastActivityTime = millis();
+    _asyncRequestTime = _asyncLastActivityTime;
+}
+
+bool ArduinoSpotify::poll()
+{
+    if (_asyncState == spotify_async_idle)
+        {
+            // Nothing else going on, so a good time to renew the token
+            // before it expires rather than in the middle of a request.
+            if (autoTokenRefresh && isTokenRefreshDue() && startTokenRefresh())
+                {
+                    _asyncInBackground = true;
+                    return true;
+                }
+            return false;
+        }
     
-    strcat(command, id + 14);
+    // Only read what has already arrived, so this never waits on the network
+    if (client->available())
+        {
+            _asyncLastActivityTime = millis();
+        }
     
-#ifdef SPOTIFY_DEBUG
-    Serial.println(command);
+    if (_asyncState == spotify_async_headers && _response.parseHeaders())
+        {
+#ifdef SPOTIFY_STATS
+            recordResponseStats(_asyncRequestTime);
 #endif
+            _asyncStatusCode = _response.getStatusCode();
+            _asyncState = spotify_async_body;
+        }
     
-    if (autoTokenRefresh) {
-        checkAndRefreshAccessToken();
-    }
-    
-    
-    const size_t bufferSize = audioFeaturesBufferSize;
-    int statusCode = makeGetRequest(command, _bearerToken);
-    
-    if (statusCode > 0) {
-        skipHeaders();
-    }
-    
-    if (statusCode == 200) {
-        // Allocate DynamicJsonDocument
-        DynamicJsonDocument doc(bufferSize);
-        
-        // Parse JSON object
-        DeserializationError error = deserializeJson(doc, *client);
-        if (!error) {
-            audioFeatures.danceability = doc["danceability"].as<float>();
-            audioFeatures.energy = doc["energy"].as<float>();
-            audioFeatures.key = doc["key"].as<int>();
-            audioFeatures.loudness = doc["loudness"].as<float>();
-            audioFeatures.mode = doc["mode"].as<int>();
-            audioFeatures.speechiness = doc["speechiness"].as<float>();
-            audioFeatures.acousticness = doc["acousticness"].as<float>();
-            audioFeatures.instrumentalness = doc["instrumentalness"].as<float>();
-            audioFeatures.liveness = doc["liveness"].as<float>();
-            audioFeatures.valence = doc["valence"].as<float>();
-            audioFeatures.tempo = doc["tempo"].as<float>();
-            audioFeatures.duration_ms = doc["duration_ms"].as<int>();
-            audioFeatures.time_signature = doc["time_signature"].as<int>();
+    if (_asyncState == spotify_async_body)
+        {
+            if (_asyncStatusCode != 200 || _asyncRequestType == spotify_async_player_command)
+                {
+                    // e.g. 204 when nothing is playing, no body to parse
+                    finishAsyncRequest();
+                    return false;
+                }
             
-            audioFeatures.error = false;
-        } else {
-            Serial.print(F("deserializeJson() failed with code "));
-            Serial.println(error.c_str());
+            if (_response.available())
+                {
+                    // Once the body starts arriving the rest follows
+                    // straight after it, so it's parsed in one go.
+                    parseAsyncBody();
+                    finishAsyncRequest();
+                    return false;
+                }
         }
-        
-        
-    }
     
+    if (millis() - _asyncLastActivityTime > SPOTIFY_TIMEOUT)
+        {
+            SPOTIFY_LOG_WARNLN(F("Request timed out"));
+            _asyncStatusCode = -1;
+            stopClient();
+            finishAsyncRequest();
+            return false;
+        }
     
-    closeClient();
-    return audioFeatures;
+    return true;
 }
 
-PlayerDetails ArduinoSpotify::getPlayerDetails(const char *market) {
-    char command[100] = SPOTIFY_PLAYER_ENDPOINT;
-    if (market[0] != 0) {
-        char marketBuff[30];
-        sprintf(marketBuff, "?market=%s", market);
-        strcat(command, marketBuff);
-    }
-    
-#ifdef SPOTIFY_DEBUG
-    Serial.println(command);
-#endif
-    
-    // Get from https://arduinojson.org/v6/assistant/
-    const size_t bufferSize = playerDetailsBufferSize;
-    PlayerDetails playerDetails;
-    // This flag will get cleared if all goes well
-    playerDetails.error = true;
-    if (autoTokenRefresh) {
-        checkAndRefreshAccessToken();
-    }
-    
-    int statusCode = makeGetRequest(command, _bearerToken);
-    if (statusCode > 0) {
-        skipHeaders();
-    }
-    
-    if (statusCode == 200) {
-        // Allocate DynamicJsonDocument
-        DynamicJsonDocument doc(bufferSize);
-        
-        // Parse JSON object
-        DeserializationError error = deserializeJson(doc, *client);
-        if (!error) {
-            JsonObject device = doc["device"];
-            
-            playerDetails.device.id = (char *)device["id"].as<char *>();
-            playerDetails.device.name = (char *)device["name"].as<char *>();
-            playerDetails.device.type = (char *)device["type"].as<char *>();
-            playerDetails.device.isActive = device["is_active"].as<bool>();
-            playerDetails.device.isPrivateSession = device["is_private_session"].as<bool>();
-            playerDetails.device.isRestricted = device["is_restricted"].as<bool>();
-            playerDetails.device.volumePrecent = device["volume_percent"].as<int>();
-            
-            playerDetails.progressMs = doc["progress_ms"].as<long>();
-            playerDetails.isPlaying = doc["is_playing"].as<bool>();
-            
-            playerDetails.shuffleState = doc["shuffle_state"].as<bool>();
-            
-            const char *repeat_state = doc["repeat_state"]; // "off"
-            
-            if (strncmp(repeat_state, "track", 5) == 0) {    playerDetails.repeateState = repeat_track;
-            }
-            else if (strncmp(repeat_state, "context", 7) == 0) {    playerDetails.repeateState = repeat_context;
-            }
-            else {    playerDetails.repeateState = repeat_off;
-            }
-            
-            playerDetails.error = false;
+void ArduinoSpotify::parseAsyncBody()
+{
+    switch (_asyncRequestType)
+        {
+            case spotify_async_currently_playing:
+                {
+                    CurrentlyPlaying currentlyPlaying;
+                    _asyncStatusCode = parseCurrentlyPlaying(currentlyPlaying, detectCurrentlyPlayingChanges);
+                    if (_asyncStatusCode == 200)
+                        {
+                            _asyncCurrentlyPlayingCallback(currentlyPlaying);
+                        }
+                    break;
+                }
+            case spotify_async_player_details:
+                {
+                    PlayerDetails playerDetails;
+                    if (parsePlayerDetails(playerDetails))
+                        {
+                            _asyncPlayerDetailsCallback(playerDetails);
+                        }
+                    else
+                        {
+                            _asyncStatusCode = -1;
+                        }
+                    break;
+                }
+            case spotify_async_refresh_token:
+                {
+                    if (!parseAccessToken(_asyncRequestTime))
+                        {
+                            _asyncStatusCode = -1;
+                        }
+                    break;
+                }
+            case spotify_async_player_command:
+                break;
+        }
+}
+
+void ArduinoSpotify::finishRequestInProgress()
+{
+    // The blocking requests share the client and the response with the
+    // non-blocking ones, so whatever is in progress has to finish first.
+    while (_asyncState != spotify_async_idle)
+        {
+            poll();
+            yield();
+        }
+}
+
+void ArduinoSpotify::finishAsyncRequest()
+{
+    _asyncState = spotify_async_idle;
+    if (_asyncRequestType == spotify_async_player_command)
+        {
+            _playerCommandStatusCode = _asyncStatusCode;
         }
-        else
-            {
-                Serial.print(F("deserializeJson() failed with code "));
-                Serial.println(error.c_str());
-            }
-    }
     closeClient();
-    return playerDetails;
+    // The sketch didn't ask for the refreshes poll() starts itself
+    if (requestCompleteCallback != NULL && !_asyncInBackground)
+        {
+            requestCompleteCallback(_asyncStatusCode);
+        }
 }
 
-bool ArduinoSpotify::getImage(char *imageUrl, Stream *file)
+bool ArduinoSpotify::startImageRequest(char *imageUrl)
 {
-#ifdef SPOTIFY_DEBUG
-    Serial.print(F("Parsing image URL: "));
-    Serial.println(imageUrl);
-#endif
+    memset(&_lastImageTransfer, 0, sizeof(_lastImageTransfer));
+    _imageRequestTime = millis();
+    SPOTIFY_LOG_DEBUG(F("Parsing image URL: "));
+    SPOTIFY_LOG_DEBUGLN(imageUrl);
     
     uint8_t lengthOfString = strlen(imageUrl);
     
@@ -653,15 +2263,21 @@ bool ArduinoSpotify::getImage(char *imageUrl, Stream *file)
     
     if (strncmp(imageUrl, "https://", 8) != 0)
         {
-            Serial.print(F("Url not in expected format: "));
-            Serial.println(imageUrl);
-            Serial.println("(expected it to start with \"https://\")");
+            SPOTIFY_LOG_ERROR(F("Url not in expected format: "));
+            SPOTIFY_LOG_ERRORLN(imageUrl);
+            SPOTIFY_LOG_ERRORLN(F("(expected it to start with \"https://\")"));
             return false;
         }
     
     uint8_t protocolLength = 8;
     
     char *pathStart = strchr(imageUrl + protocolLength, '/');
+    if (pathStart == NULL)
+        {
+            SPOTIFY_LOG_ERROR(F("Url has no path: "));
+            SPOTIFY_LOG_ERRORLN(imageUrl);
+            return false;
+        }
     uint8_t pathIndex = pathStart - imageUrl;
     uint8_t pathLength = lengthOfString - pathIndex;
     char path[pathLength + 1];
@@ -673,154 +2289,422 @@ bool ArduinoSpotify::getImage(char *imageUrl, Stream *file)
     strncpy(host, imageUrl + protocolLength, hostLength);
     host[hostLength] = '\0';
     
-#ifdef SPOTIFY_DEBUG
     
-    Serial.print(F("host: "));
-    Serial.println(host);
+    SPOTIFY_LOG_DEBUG(F("host: "));
+    SPOTIFY_LOG_DEBUGLN(host);
     
-    Serial.print(F("len:host:"));
-    Serial.println(hostLength);
+    SPOTIFY_LOG_DEBUG(F("len:host:"));
+    SPOTIFY_LOG_DEBUGLN(hostLength);
     
-    Serial.print(F("path: "));
-    Serial.println(path);
+    SPOTIFY_LOG_DEBUG(F("path: "));
+    SPOTIFY_LOG_DEBUGLN(path);
     
-    Serial.print(F("len:path: "));
-    Serial.println(strlen(path));
-#endif
+    SPOTIFY_LOG_DEBUG(F("len:path: "));
+    SPOTIFY_LOG_DEBUGLN(strlen(path));
     
-    bool status = false;
     int statusCode = makeGetRequest(path, NULL, "text/html,application/xhtml+xml,application/xml;q=0.9,image/webp,*/*;q=0.8", host);
-#ifdef SPOTIFY_DEBUG
-    Serial.print(F("statusCode: "));
-    Serial.println(statusCode);
-#endif
-    if (statusCode == 200)
+    SPOTIFY_LOG_DEBUG(F("statusCode: "));
+    SPOTIFY_LOG_DEBUGLN(statusCode);
+    if (statusCode != 200)
+        {
+            closeClient();
+            return false;
+        }
+    
+    SPOTIFY_LOG_DEBUG(F("file length: "));
+    SPOTIFY_LOG_DEBUGLN(_response.getContentLength());
+    return true;
+}
+
+bool ArduinoSpotify::readImageBody(Stream *file, uint8_t *imageData, processImageData imageDataCallback)
+{
+    // This section of code is inspired but the "Web_Jpg"
+    // example of TJpg_Decoder
+    // https://github.com/Bodmer/TJpg_Decoder
+    // -----------
+    size_t buffSize = 0;
+    uint8_t *buff = NULL;
+    if (imageData == NULL)
+        {
+            buff = getImageBuffer(&buffSize);
+            if (buff == NULL)
+                {
+                    SPOTIFY_LOG_ERRORLN(F("Not enough memory for the image buffer"));
+                    return false;
+                }
+        }
+    
+    // -1 if the server didn't say (chunked)
+    int totalLength = _response.getContentLength();
+    int offset = 0;
+    unsigned long bodyStartTime = millis();
+    unsigned long lastDataTime = bodyStartTime;
+    bool complete;
+    // _response only gives us the body, and stops exactly at the end of it
+    while (!(complete = _response.isBodyComplete()))
         {
-            int totalLength = getContentLength();
-#ifdef SPOTIFY_DEBUG
-            Serial.print(F("file length: "));
-            Serial.println(totalLength);
-#endif
-            if (totalLength > 0)
-                {
-                    skipHeaders(false);
-                    int remaining = totalLength;
-                    // This section of code is inspired but the "Web_Jpg"
-                    // example of TJpg_Decoder
-                    // https://github.com/Bodmer/TJpg_Decoder
-                    // -----------
-                    uint8_t buff[128] = {0};
-                    while (client->connected() && (remaining > 0 || remaining == -1)) {    // Get available data size
-                        size_t size = client->available();
-                        
-                        if (size) {
-                            // Read up to 128 bytes
-                            int c = client->readBytes(buff, ((size > sizeof(buff)) ? sizeof(buff) : size));
-                            
-                            // Write it to file
-                            file->write(buff, c);
-                            
-                            // Calculate remaining bytes
-                            if (remaining > 0)
+            int size = _response.available();
+            
+            if (size > 0)
+                {
+                    int c;
+                    if (imageData != NULL)
+                        {
+                            // Straight into the caller's buffer, no need to copy.
+                            // It is sized from the Content-Length, which is as
+                            // much as _response will give us.
+                            c = _response.read(imageData + offset, size);
+                        }
+                    else
+                        {
+                            c = _response.read(buff, ((size_t)size > buffSize) ? buffSize : size);
+                        }
+                    
+                    if (c <= 0)
+                        {
+                            SPOTIFY_LOG_ERRORLN(F("Failed to read the image"));
+                            return false;
+                        }
+                    
+                    if (imageData == NULL)
+                        {
+                            if (file != NULL)
+                                {
+                                    file->write(buff, c);
+                                }
+                            else if (!imageDataCallback(buff, c, offset, totalLength))
                                 {
-                                    remaining -= c;
+                                    SPOTIFY_LOG_DEBUGLN(F("Image cancelled by callback"));
+                                    return false;
                                 }
                         }
-                        yield();
-                    }
-                    // ---------
-#ifdef SPOTIFY_DEBUG
-                    Serial.println(F("Finished getting image"));
-#endif
-                    // probably?!
-                    status = true;
+                    
+                    offset += c;
+                    lastDataTime = millis();
+                }
+            else if (!client->connected() && !client->available())
+                {
+                    SPOTIFY_LOG_ERRORLN(F("Connection closed before the end of the image"));
+                    break;
+                }
+            else if (millis() - lastDataTime > SPOTIFY_TIMEOUT)
+                {
+                    SPOTIFY_LOG_ERRORLN(F("Timed out reading image"));
+                    break;
                 }
+            yield();
+        }
+    // ---------
+    
+    unsigned long now = millis();
+    _lastImageTransfer.bytes = offset;
+    _lastImageTransfer.totalTimeMs = now - _imageRequestTime;
+    unsigned long bodyTimeMs = now - bodyStartTime;
+    _lastImageTransfer.bytesPerSecond = bodyTimeMs > 0 ? (unsigned long)(offset * 1000ULL / bodyTimeMs) : offset;
+    
+    SPOTIFY_LOG_DEBUGLN(F("Finished getting image"));
+    SPOTIFY_LOG_DEBUG(F("Time (ms): "));
+    SPOTIFY_LOG_DEBUGLN(_lastImageTransfer.totalTimeMs);
+    SPOTIFY_LOG_DEBUG(F("Bytes/s: "));
+    SPOTIFY_LOG_DEBUGLN(_lastImageTransfer.bytesPerSecond);
+    return complete;
+}
+
+uint8_t *ArduinoSpotify::getImageBuffer(size_t *size)
+{
+    if (_imageBuffer == NULL || (_ownsImageBuffer && _imageBufferLength != (size_t)imageBufferSize))
+        {
+            // Kept for next time, so it doesn't need allocating again
+            if (_ownsImageBuffer)
+                {
+                    free(_imageBuffer);
+                }
+            _imageBuffer = (uint8_t *)malloc(imageBufferSize);
+            _imageBufferLength = _imageBuffer != NULL ? imageBufferSize : 0;
+            _ownsImageBuffer = true;
+        }
+    
+    *size = _imageBufferLength;
+    return _imageBuffer;
+}
+
+void ArduinoSpotify::setImageBuffer(uint8_t *buffer, size_t size)
+{
+    if (_ownsImageBuffer)
+        {
+            free(_imageBuffer);
+        }
+    _imageBuffer = buffer;
+    _imageBufferLength = buffer != NULL ? size : 0;
+    _ownsImageBuffer = false;
+}
+
+ImageTransferInfo ArduinoSpotify::getLastImageTransfer()
+{
+    return _lastImageTransfer;
+}
+
+bool ArduinoSpotify::getImage(char *imageUrl, Stream *file)
+{
+    if (!startImageRequest(imageUrl))
+        {
+            return false;
         }
     
+    bool status = readImageBody(file, NULL, NULL);
+    if (!status)
+        {
+            // Whatever is left of the body would confuse the next request
+            stopClient();
+        }
     closeClient();
     
     return status;
 }
 
-int ArduinoSpotify::getContentLength()
+bool ArduinoSpotify::getImage(char *imageUrl, processImageData imageDataCallback)
 {
+    if (!startImageRequest(imageUrl))
+        {
+            return false;
+        }
     
-    if (client->find("Content-Length:"))
+    bool status = readImageBody(NULL, NULL, imageDataCallback);
+    if (!status)
         {
-            int contentLength = client->parseInt();
-#ifdef SPOTIFY_DEBUG
-            Serial.print(F("Content-Length: "));
-            Serial.println(contentLength);
-#endif
-            return contentLength;
+            stopClient();
         }
+    closeClient();
     
-    return -1;
+    return status;
 }
 
-void ArduinoSpotify::skipHeaders(bool tossUnexpectedForJSON)
+int ArduinoSpotify::getImage(char *imageUrl, uint8_t **imageData)
 {
-    // Skip HTTP headers
-    if (!client->find("\r\n\r\n"))
+    *imageData = NULL;
+    if (!startImageRequest(imageUrl))
         {
-            Serial.println(F("Invalid response"));
-            return;
+            return -1;
         }
     
-    if (tossUnexpectedForJSON)
+    int totalLength = _response.getContentLength();
+    if (totalLength <= 0)
         {
-            // Was getting stray characters between the headers and the body
-            // This should toss them away
-            while (client->available() && client->peek() != '{')
-                {
-                    char c = 0;
-                    client->readBytes(&c, 1);
-#ifdef SPOTIFY_DEBUG
-                    Serial.print(F("Tossing an unexpected character: "));
-                    Serial.println(c);
-#endif
-                }
+            SPOTIFY_LOG_ERRORLN(F("Image size not known, can't allocate a buffer for it"));
+            stopClient();
+            return -1;
+        }
+    
+    if (maxImageSize > 0 && totalLength > maxImageSize)
+        {
+            SPOTIFY_LOG_ERROR(F("Image too big: "));
+            SPOTIFY_LOG_ERRORLN(totalLength);
+            stopClient();
+            return -1;
+        }
+    
+    uint8_t *buffer = (uint8_t *)malloc(totalLength);
+    if (buffer == NULL)
+        {
+            SPOTIFY_LOG_ERROR(F("Not enough memory for image: "));
+            SPOTIFY_LOG_ERRORLN(totalLength);
+            stopClient();
+            return -1;
         }
+    
+    if (!readImageBody(NULL, buffer, NULL))
+        {
+            free(buffer);
+            stopClient();
+            return -1;
+        }
+    closeClient();
+    
+    *imageData = buffer;
+    return totalLength;
 }
 
-int ArduinoSpotify::getHttpStatusCode()
+#ifdef SPOTIFY_STATS
+SpotifyRequestStats ArduinoSpotify::getLastRequestStats()
+{
+    return _stats;
+}
+
+void ArduinoSpotify::printLastRequestStats(Print &output)
+{
+    output.print(F("Status: "));
+    output.println(_stats.statusCode);
+    output.print(F("Connect (ms): "));
+    output.print(_stats.connectMs);
+    output.println(_stats.reusedConnection ? F(" (reused)") : F(""));
+    output.print(F("Send (ms): "));
+    output.println(_stats.sendMs);
+    output.print(F("Wait (ms): "));
+    output.println(_stats.waitMs);
+    output.print(F("Headers (ms): "));
+    output.println(_stats.headersMs);
+    output.print(F("Parse (ms): "));
+    output.println(_stats.parseMs);
+    output.print(F("Total (ms): "));
+    output.println(_stats.totalMs);
+    output.print(F("Bytes sent/received: "));
+    output.print(_stats.bytesSent);
+    output.print(F("/"));
+    output.println(_stats.bytesReceived);
+    output.print(F("JSON used/capacity: "));
+    output.print((unsigned long)_stats.jsonMemoryUsage);
+    output.print(F("/"));
+    output.println((unsigned long)_stats.jsonCapacity);
+    output.print(F("Min free heap: "));
+    output.println((unsigned long)_stats.minFreeHeap);
+}
+
+void ArduinoSpotify::startRequestStats()
+{
+    memset(&_stats, 0, sizeof(_stats));
+    _statsStartTime = millis();
+    recordFreeHeap();
+}
+
+void ArduinoSpotify::recordResponseStats(unsigned long sentTime)
 {
-    // Check HTTP status
-    if (client->find("HTTP/1.1"))
+    unsigned long firstByteTime = _response.getFirstByteTime();
+    _stats.statusCode = _response.getStatusCode();
+    _stats.waitMs = firstByteTime - sentTime;
+    _stats.headersMs = millis() - firstByteTime;
+    recordFreeHeap();
+}
+
+void ArduinoSpotify::recordParseStats(JsonDocument &doc, unsigned long parseStart)
+{
+    // Called while the document is still in memory, the likely low point
+    _stats.parseMs = millis() - parseStart;
+    _stats.jsonMemoryUsage = doc.memoryUsage();
+    _stats.jsonCapacity = doc.capacity();
+    recordFreeHeap();
+}
+
+void ArduinoSpotify::recordFreeHeap()
+{
+#if defined(ESP8266) || defined(ESP32)
+    uint32_t freeHeap = ESP.getFreeHeap();
+    if (_stats.minFreeHeap == 0 || freeHeap < _stats.minFreeHeap)
         {
-            int statusCode = client->parseInt();
-#ifdef SPOTIFY_DEBUG
-            Serial.print(F("Status Code: "));
-            Serial.println(statusCode);
+            _stats.minFreeHeap = freeHeap;
+        }
 #endif
-            return statusCode;
+}
+#endif
+
+unsigned long ArduinoSpotify::getRetryAfterMs()
+{
+    return atol(_response.getHeader(spotify_header_retry_after)) * 1000UL;
+}
+
+int ArduinoSpotify::getHttpStatusCode()
+{
+#ifdef SPOTIFY_STATS
+    unsigned long sentTime = millis();
+#endif
+    // The headers we need are kept as they go past, and the body is then
+    // read through _response so it ends exactly where the response does.
+    _response.begin(client, SPOTIFY_TIMEOUT);
+    if (!_response.readHeaders())
+        {
+            return -1;
         }
     
-    return -1;
+#ifdef SPOTIFY_STATS
+    recordResponseStats(sentTime);
+#endif
+    return _response.getStatusCode();
+}
+
+Stream &ArduinoSpotify::getBody()
+{
+    // Called once per response, after the headers
+    if (strcasecmp(_response.getHeader(spotify_header_content_encoding), "gzip") != 0)
+        {
+            return _response;
+        }
+    if (!_gzipStream.begin(&_response))
+        {
+            // The stream reads as empty, so this one fails to parse, but
+            // the next ones won't be gzipped
+            SPOTIFY_LOG_ERRORLN(F("Not enough memory to inflate the response, not asking for gzip again"));
+            _gzipUnavailable = true;
+        }
+    return _gzipStream;
+}
+
+void ArduinoSpotify::copyString(char *dest, const char *src, size_t destSize)
+{
+    // The result structs hold their own copies of the strings, so they
+    // are still valid after the JSON document has been freed.
+    if (src == NULL)
+        {
+            dest[0] = '\0';
+            return;
+        }
+    strncpy(dest, src, destSize - 1);
+    dest[destSize - 1] = '\0';
 }
 
 void ArduinoSpotify::parseError()
 {
+    // Only read to be printed, the rest of the response is skipped anyway
+#if SPOTIFY_LOG_LEVEL >= SPOTIFY_LOG_LEVEL_ERROR
     DynamicJsonDocument doc(1000);
-    DeserializationError error = deserializeJson(doc, *client);
+#ifdef SPOTIFY_STATS
+    unsigned long parseStart = millis();
+#endif
+    DeserializationError error = deserializeJson(doc, _response);
+#ifdef SPOTIFY_STATS
+    recordParseStats(doc, parseStart);
+#endif
     if (!error)
         {
-            Serial.print(F("getAuthToken error"));
-            serializeJson(doc, Serial);
+            SPOTIFY_LOG_ERROR(F("getAuthToken error"));
+            if (spotifyLogOutput != NULL)
+                {
+                    serializeJson(doc, *spotifyLogOutput);
+                }
+            SPOTIFY_LOG_ERRORLN(F(""));
         }
     else
         {
-            Serial.print(F("Could not parse error"));
+            SPOTIFY_LOG_ERRORLN(F("Could not parse error"));
         }
+#endif
 }
 
 void ArduinoSpotify::closeClient()
+{
+    // The connection can only be used again once the rest of the
+    // response has been read, and if the server didn't say it is closing.
+    bool reuse = keepAlive && _response.skipBody() && _response.canReuseConnection();
+#ifdef SPOTIFY_STATS
+    _stats.bytesReceived = _response.getBytesReceived();
+    _stats.totalMs = millis() - _statsStartTime;
+    recordFreeHeap();
+#endif
+    if (reuse)
+        {
+            // Leave it open for the next request, connectClient will
+            // reconnect if the server has closed it in the meantime.
+            _lastActivityTime = millis();
+            return;
+        }
+    
+    stopClient();
+}
+
+void ArduinoSpotify::stopClient()
 {
     if (client->connected())
         {
-#ifdef SPOTIFY_DEBUG
-            Serial.println(F("Closing client"));
-#endif
+            SPOTIFY_LOG_DEBUGLN(F("Closing client"));
             client->stop();
         }
+    _connectedHost[0] = '\0';
 }
\ No newline at end of file
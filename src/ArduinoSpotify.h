@@ -21,16 +21,20 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
 #ifndef ArduinoSpotify_h
 #define ArduinoSpotify_h
 
-// I find setting these types of flags unreliable from the Arduino IDE
-// so uncomment this if its not working for you.
-// NOTE: Do not use this option on live-streams, it will reveal your
-// private tokens!
+// Uncomment to keep timings and memory use for each request, see
+// getLastRequestStats(). It costs a little time and RAM so is off by default.
 
-//#define SPOTIFY_DEBUG 1
+//#define SPOTIFY_STATS
 
 #include <Arduino.h>
 #include <ArduinoJson.h>
 #include <Client.h>
+#include <time.h>
+#include "SpotifyLog.h"
+#include "SpotifyTokenStore.h"
+#include "SpotifyHttpRequest.h"
+#include "SpotifyHttpResponse.h"
+#include "SpotifyGzipStream.h"
 
 
 #define SPOTIFY_HOST "api.spotify.com"
@@ -39,6 +43,16 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
 #define SPOTIFY_FINGERPRINT "B9 79 6B CE FD 61 21 97 A7 02 90 EE DA CD F0 A0 44 13 0E EB"
 #define SPOTIFY_TIMEOUT 2000
 
+// How long to wait before trying to renew the token again after a failure
+#define SPOTIFY_TOKEN_RETRY_MS 10000
+
+// Any earlier than this and the clock hasn't been set (1st Jan 2020)
+#define SPOTIFY_MIN_VALID_TIME 1577836800UL
+
+// Spotify's tokens last an hour. A stored one that says it has longer
+// left was saved while the clock was wrong, so isn't trusted.
+#define SPOTIFY_MAX_TOKEN_LIFETIME 3600UL
+
 #define SPOTIFY_CURRENTLY_PLAYING_ENDPOINT "/v1/me/player/currently-playing"
 
 #define SPOTIFY_PLAYER_ENDPOINT "/v1/me/player"
@@ -56,11 +70,55 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
 
 #define SPOTIFY_AUDIO_FEATURES_ENDPOINT "/v1/audio-features"
 
+#define SPOTIFY_PLAYLIST_TRACKS_ENDPOINT "/v1/playlists/%s/tracks"
+#define SPOTIFY_SAVED_TRACKS_ENDPOINT "/v1/me/tracks"
+#define SPOTIFY_QUEUE_ENDPOINT "/v1/me/player/queue"
+
+// Only what SpotifyTrack needs is asked for (playlists only, the saved
+// tracks endpoint doesn't support fields)
+#define SPOTIFY_PAGED_TRACK_FIELDS "items(track(name,uri,duration_ms,artists(name))),next,total"
+
 #define SPOTIFY_TOKEN_ENDPOINT "/api/token"
 
 #define SPOTIFY_NUM_ALBUM_IMAGES 3
 
-#define SPOTIFY_DEBUG true
+// Sizes of the strings stored in the result structs, including the
+// terminator. Longer values are truncated.
+#define SPOTIFY_NAME_CHAR_LENGTH 100
+#define SPOTIFY_URI_CHAR_LENGTH 40
+#define SPOTIFY_URL_CHAR_LENGTH 70
+#define SPOTIFY_DEVICE_ID_CHAR_LENGTH 45
+#define SPOTIFY_DEVICE_TYPE_CHAR_LENGTH 20
+#define SPOTIFY_ETAG_CHAR_LENGTH 64
+#define SPOTIFY_TRACK_ID_CHAR_LENGTH 23
+
+// Longest endpoint path, including its query parameters
+#define SPOTIFY_PATH_LENGTH 150
+// Paged requests also carry the fields, limit and offset
+#define SPOTIFY_PAGING_PATH_LENGTH 256
+
+// Default size of the buffer images are read through when they go to a
+// Stream or callback (images read into RAM don't need one)
+#define SPOTIFY_IMAGE_BUFFER_SIZE 1024
+
+// Sizes of the documents describing which fields to keep when parsing.
+// They follow the shape of the filters rather than being a byte count,
+// as the slots are twice the size on 64-bit hosts. The currently playing
+// one is the root, item and album objects, then one artist and one image.
+#define SPOTIFY_CURRENTLY_PLAYING_FILTER_SIZE (JSON_OBJECT_SIZE(3) + JSON_OBJECT_SIZE(4) * 2 + JSON_ARRAY_SIZE(1) * 2 + JSON_OBJECT_SIZE(2) + JSON_OBJECT_SIZE(3))
+#define SPOTIFY_PLAYER_DETAILS_FILTER_SIZE JSON_OBJECT_SIZE(5)
+#define SPOTIFY_PLAYER_SNAPSHOT_FILTER_SIZE (SPOTIFY_CURRENTLY_PLAYING_FILTER_SIZE + SPOTIFY_PLAYER_DETAILS_FILTER_SIZE)
+#define SPOTIFY_AUDIO_FEATURES_FILTER_SIZE JSON_OBJECT_SIZE(13)
+// The track, wrapped in an item for playlists and saved tracks
+#define SPOTIFY_PAGED_TRACK_FILTER_SIZE (JSON_OBJECT_SIZE(1) + JSON_OBJECT_SIZE(4) + JSON_ARRAY_SIZE(1) + JSON_OBJECT_SIZE(1))
+
+// Most tracks asked about in one /v1/audio-features?ids= request, longer
+// lists are split up. Spotify allows up to 100, but the request line is
+// built on the stack (about 23 bytes per track).
+#define SPOTIFY_AUDIO_FEATURES_BATCH_SIZE 20
+
+class SpotifyAudioFeaturesCache;
+class SpotifyPipeline;
 
 enum RepeatOptions
 {
@@ -73,14 +131,50 @@ struct SpotifyImage
 {
   int height;
   int width;
-  char *url;
+  char url[SPOTIFY_URL_CHAR_LENGTH];
+};
+
+// How the last getImage() went
+struct ImageTransferInfo
+{
+  int bytes;
+  // From starting the request (including connecting) to the last byte
+  unsigned long totalTimeMs;
+  // Speed of reading the body, not counting connecting
+  unsigned long bytesPerSecond;
 };
 
+#ifdef SPOTIFY_STATS
+// What happened during the last request. Times are in ms.
+struct SpotifyRequestStats
+{
+  int statusCode;
+  bool reusedConnection;
+  // Includes the TLS handshake, 0 when the connection was reused
+  unsigned long connectMs;
+  unsigned long sendMs;
+  // From sending the request to the first byte of the response
+  unsigned long waitMs;
+  unsigned long headersMs;
+  // deserializeJson() and copying the results out
+  unsigned long parseMs;
+  unsigned long totalMs;
+  unsigned long bytesSent;
+  // The whole response, including headers
+  unsigned long bytesReceived;
+  // How much of the JSON document was used, compare to the buffer sizes
+  size_t jsonMemoryUsage;
+  size_t jsonCapacity;
+  // Lowest free heap seen during the request (ESP8266/ESP32 only, else 0)
+  uint32_t minFreeHeap;
+};
+#endif
+
 struct SpotifyDevice
 {
-  char *id;
-  char *name;
-  char *type;
+  char id[SPOTIFY_DEVICE_ID_CHAR_LENGTH];
+  char name[SPOTIFY_NAME_CHAR_LENGTH];
+  char type[SPOTIFY_DEVICE_TYPE_CHAR_LENGTH];
   bool isActive;
   bool isRestricted;
   bool isPrivateSession;
@@ -101,13 +195,13 @@ struct PlayerDetails
 
 struct CurrentlyPlaying
 {
-  char *firstArtistName;
-  char *firstArtistUri;
-  char *albumName;
-  char *albumUri;
-  char *trackName;
-  char *trackUri;
-  SpotifyImage albumImages[3];
+  char firstArtistName[SPOTIFY_NAME_CHAR_LENGTH];
+  char firstArtistUri[SPOTIFY_URI_CHAR_LENGTH];
+  char albumName[SPOTIFY_NAME_CHAR_LENGTH];
+  char albumUri[SPOTIFY_URI_CHAR_LENGTH];
+  char trackName[SPOTIFY_NAME_CHAR_LENGTH];
+  char trackUri[SPOTIFY_URI_CHAR_LENGTH];
+  SpotifyImage albumImages[SPOTIFY_NUM_ALBUM_IMAGES];
   int numImages;
   bool isPlaying;
   long progressMs;
@@ -135,6 +229,81 @@ struct AudioFeatures
   bool error;
 };
 
+// One track of a playlist, saved tracks or the queue
+struct SpotifyTrack
+{
+  char trackName[SPOTIFY_NAME_CHAR_LENGTH];
+  char trackUri[SPOTIFY_URI_CHAR_LENGTH];
+  char firstArtistName[SPOTIFY_NAME_CHAR_LENGTH];
+  long durationMs;
+
+  // e.g. a track that is no longer available
+  bool error;
+};
+
+// Everything a display usually shows, see getPlayerSnapshot()
+struct PlayerSnapshot
+{
+  PlayerDetails playerDetails;
+  CurrentlyPlaying currentlyPlaying;
+  AudioFeatures audioFeatures;
+  // True if audioFeatures was fetched by this call (the track changed)
+  bool audioFeaturesUpdated;
+
+  bool error;
+};
+
+// Called with the result while it is still in scope, so the caller
+// doesn't need to keep a copy of it.
+typedef void (*processCurrentlyPlaying)(CurrentlyPlaying &currentlyPlaying);
+typedef void (*processPlayerDetails)(PlayerDetails &playerDetails);
+typedef void (*processAudioFeatures)(AudioFeatures &audioFeatures);
+typedef void (*processTrackAudioFeatures)(const char *uri, AudioFeatures &audioFeatures);
+typedef void (*processRequestComplete)(int statusCode);
+// Called with each track and its position in the list, return false to stop
+typedef bool (*processTrack)(SpotifyTrack &track, int index);
+// Called with each piece of an image as it arrives. offset is where data
+// starts within the image, totalLength is the size of the whole image
+// (-1 if the server didn't say).
+// Return false to stop the download.
+typedef bool (*processImageData)(uint8_t *data, size_t length, int offset, int totalLength);
+
+enum SpotifyAsyncState
+{
+  spotify_async_idle,
+  spotify_async_headers,
+  spotify_async_body
+};
+
+enum SpotifyAsyncRequestType
+{
+  spotify_async_currently_playing,
+  spotify_async_player_details,
+  spotify_async_refresh_token,
+  spotify_async_player_command
+};
+
+// Everything kept for one user: their token and what the last currently
+// playing response was, for detectCurrentlyPlayingChanges. Only a few
+// hundred bytes, so one ArduinoSpotify (and its client) can serve
+// several users, see SpotifyAccounts.h.
+struct SpotifyAccount
+{
+  // "Bearer " and the access token
+  char bearerToken[SPOTIFY_STORED_TOKEN_CHAR_LENGTH + 7];
+  const char *refreshToken;
+  unsigned long timeTokenRefreshed;
+  unsigned long tokenTimeToLiveMs;
+  unsigned long tokenRefreshDueMs;
+  unsigned long lastTokenRefreshAttempt;
+  SpotifyTokenStore *tokenStore;
+  char currentlyPlayingEtag[SPOTIFY_ETAG_CHAR_LENGTH];
+  uint32_t lastTrackHash;
+  bool lastIsPlaying;
+  long lastProgressMs;
+  unsigned long lastProgressTime;
+};
+
 class ArduinoSpotify
 {
 public:
@@ -145,10 +314,25 @@ public:
   void setRefreshToken(const char *refreshToken);
   bool refreshAccessToken();
   bool checkAndRefreshAccessToken();
+  bool isTokenRefreshDue();
+  // Non-blocking version of refreshAccessToken(), finished by poll().
+  // poll() also calls this itself when isTokenRefreshDue().
+  bool startTokenRefresh();
+  // New access tokens get saved to the store, and loadStoredAccessToken()
+  // reads it back (e.g. in setup()) if it hasn't expired, saving a refresh.
+  void setTokenStore(SpotifyTokenStore *tokenStore);
+  bool loadStoredAccessToken();
   const char *requestAccessTokens(const char *code, const char *redirectUrl);
+  // The methods act for the account given to setAccount(), or the one
+  // set up by the constructor if that is NULL. Accounts all use the
+  // clientId and clientSecret given to the constructor. It can't be
+  // changed while a non-blocking request is in progress.
+  void initAccount(SpotifyAccount &account, const char *refreshToken = "");
+  bool setAccount(SpotifyAccount *account);
+  SpotifyAccount *getAccount();
 
   // Generic Request Methods
-  int makeGetRequest(const char *command, const char *authorization, const char *accept = "application/json", const char *host = SPOTIFY_HOST);
+  int makeGetRequest(const char *command, const char *authorization, const char *accept = "application/json", const char *host = SPOTIFY_HOST, const char *ifNoneMatch = NULL);
   int makeRequestWithBody(const char *type, const char *command, const char *authorization, const char *body = "", const char *contentType = "application/json", const char *host = SPOTIFY_HOST);
   int makePostRequest(const char *command, const char *authorization, const char *body = "", const char *contentType = "application/json", const char *host = SPOTIFY_HOST);
   int makePutRequest(const char *command, const char *authorization, const char *body = "", const char *contentType = "application/json", const char *host = SPOTIFY_HOST);
@@ -157,6 +341,45 @@ public:
   CurrentlyPlaying getCurrentlyPlaying(const char *market = "");
   PlayerDetails getPlayerDetails(const char *market = "");
   AudioFeatures getAudioFeatures(const char * uri);
+
+  // Same as above, but fill in a result the caller owns (only the error
+  // flag is touched if the request fails) or pass it to a callback.
+  // These return the HTTP status code.
+  int getCurrentlyPlaying(CurrentlyPlaying &currentlyPlaying, const char *market = "");
+  int getCurrentlyPlaying(processCurrentlyPlaying currentlyPlayingCallback, const char *market = "");
+  int getPlayerDetails(PlayerDetails &playerDetails, const char *market = "");
+  int getPlayerDetails(processPlayerDetails playerDetailsCallback, const char *market = "");
+  int getAudioFeatures(AudioFeatures &audioFeatures, const char *uri);
+  int getAudioFeatures(processAudioFeatures audioFeaturesCallback, const char *uri);
+  // The player details and currently playing track from one request.
+  // Audio features are only requested when the track isn't the one
+  // already in the snapshot, so keep passing in the same snapshot
+  // (zeroed before the first call). Returns the player request's status.
+  int getPlayerSnapshot(PlayerSnapshot &snapshot, const char *market = "", bool withAudioFeatures = true);
+  // Audio features for a list of tracks, fetched several at a time. The
+  // callback gets each track's URI and features (with error set if
+  // Spotify didn't know it or a request failed) in the order they were
+  // asked for, once each. Returns the status code of the last request
+  // made (200 if they were all cached), -1 if a response was cut short.
+  int getAudioFeatures(const char **uris, int count, processTrackAudioFeatures audioFeaturesCallback);
+  // Keep audio features once fetched, see SpotifyAudioFeaturesCache.h
+  void setAudioFeaturesCache(SpotifyAudioFeaturesCache *audioFeaturesCache);
+  // Sends all the requests in the pipeline on one connection and passes
+  // each response to its callback in order, see SpotifyPipeline.h. If the
+  // server closes the connection part way through, the rest are sent
+  // again on a new one. Returns how many of the requests got a response.
+  int sendPipeline(SpotifyPipeline &pipeline);
+  // Tracks of a playlist, the user's saved tracks or their queue, passed
+  // to the callback one at a time, so only one is in memory however long
+  // the list is. Pages of pagingLimit tracks are requested as needed,
+  // starting from offset, until count tracks have been read (-1 for all).
+  // Returns the status code of the last request, 200 without asking when
+  // count is 0 and -1 for a negative offset.
+  int getPlaylistTracks(const char *playlistId, processTrack trackCallback, int offset = 0, int count = -1, const char *market = "");
+  int getSavedTracks(processTrack trackCallback, int offset = 0, int count = -1, const char *market = "");
+  int getQueue(processTrack trackCallback);
+  // How many tracks the last list read has, -1 if Spotify didn't say
+  int getPagingTotal();
   
   bool play(const char *deviceId = "");
   bool playAdvanced(char *body, const char *deviceId = "");
@@ -170,28 +393,182 @@ public:
   bool playerNavigate(char *command, const char *deviceId = "");
   bool seek(int position, const char *deviceId = "");
 
+  // Non-blocking versions of the above. Start the request, then call poll()
+  // from loop() until it returns false. The result callback is called if
+  // the request succeeded, and requestCompleteCallback (if set) with the
+  // status code either way. Only one request can be in progress at a time,
+  // calling a blocking method first waits for it to finish (running its
+  // callbacks). When nothing is in progress, poll() renews the token if
+  // isTokenRefreshDue(), which doesn't call requestCompleteCallback.
+  bool startCurrentlyPlaying(processCurrentlyPlaying currentlyPlayingCallback, const char *market = "");
+  bool startPlayerDetails(processPlayerDetails playerDetailsCallback, const char *market = "");
+  // A player command such as those above (method is "PUT " or "POST "),
+  // the device ID is added to the command. Used by SpotifyCommandQueue.
+  bool startPlayerCommand(const char *method, const char *command, const char *deviceId = "", const char *body = "");
+  bool poll();
+  bool isRequestInProgress();
+  // Status code of the last non-blocking request once it has finished,
+  // -1 if it failed or timed out
+  int getAsyncStatusCode();
+  // Status code of the last startPlayerCommand() once it has finished.
+  // Kept apart from getAsyncStatusCode(), as poll() may have run a token
+  // refresh or the sketch another request since.
+  int getPlayerCommandStatusCode();
+
   // Image methods
   bool getImage(char *imageUrl, Stream *file);
+  // Passes the image to the callback as it comes in, nothing is stored
+  bool getImage(char *imageUrl, processImageData imageDataCallback);
+  // Downloads the image into a buffer sized from its Content-Length and
+  // returns the size (-1 on failure). The buffer is yours to free().
+  int getImage(char *imageUrl, uint8_t **imageData);
+  // Use your own buffer for reading images instead of the one allocated
+  // (once, imageBufferSize bytes) on first use. NULL goes back to that.
+  void setImageBuffer(uint8_t *buffer, size_t size);
+  ImageTransferInfo getLastImageTransfer();
+
+  // Connection methods
+  void stopClient();
+  // How long the last response asked us to wait (Retry-After), 0 if it didn't
+  unsigned long getRetryAfterMs();
+
+#ifdef SPOTIFY_STATS
+  SpotifyRequestStats getLastRequestStats();
+  void printLastRequestStats(Print &output);
+#endif
 
   int portNumber = 443;
   int tagArraySize = 10;
-  int currentlyPlayingBufferSize = 10000;
-  int playerDetailsBufferSize = 10000;
-  int audioFeaturesBufferSize = 20000;
+  // These only need to hold the filtered fields, not the whole response
+  int currentlyPlayingBufferSize = 1500;
+  int playerDetailsBufferSize = 1000;
+  int playerSnapshotBufferSize = 2000;
+  int audioFeaturesBufferSize = 512;
+  // For each track of a paged list
+  int pagedTrackBufferSize = 512;
+  // Tracks per request for the paged lists, at most 50 for saved tracks
+  // and 100 for playlists
+  int pagingLimit = 50;
+  // Ask for the next page before reading the current one, so it is on its
+  // way while the callback runs. Starts from the second page, as the
+  // total isn't known before then.
+  bool prefetchPages = true;
+  // Largest image getImage() will allocate a buffer for, 0 (the default)
+  // for no limit. The 640px album art is often 100KB or more.
+  int maxImageSize = 0;
+  int imageBufferSize = SPOTIFY_IMAGE_BUFFER_SIZE;
   bool autoTokenRefresh = true;
+  // poll() renews the token this long (plus up to tokenRefreshJitterMs)
+  // before it expires
+  unsigned long tokenRefreshLeadTimeMs = 60000;
+  unsigned long tokenRefreshJitterMs = 30000;
+  // Reuse the connection between requests to the same host rather
+  // than doing a new TLS handshake every time.
+  bool keepAlive = false;
+  unsigned long keepAliveTimeoutMs = 30000;
+  // Ask for the API's responses to be gzipped, which makes them several
+  // times smaller. Inflating them needs SPOTIFY_GZIP_WINDOW_SIZE bytes,
+  // allocated on the first gzipped response and kept. If that fails, that
+  // response fails to parse and gzip isn't asked for again.
+  bool gzip = false;
+  processRequestComplete requestCompleteCallback = NULL;
+  // When true, getCurrentlyPlaying(CurrentlyPlaying &) returns 304 and
+  // doesn't touch the result if nothing has changed since the last call.
+  // The callback versions (and startCurrentlyPlaying() and SpotifyPipeline)
+  // give a 304 status without calling the callback. The version returning
+  // a CurrentlyPlaying ignores this and always gets the whole thing. The
+  // server's ETag is used when it sends one, otherwise the parsed track,
+  // play state and progress are compared. Progress is only a change if it
+  // is more than changeDetectionToleranceMs away from where it should be.
+  bool detectCurrentlyPlayingChanges = false;
+  long changeDetectionToleranceMs = 3000;
   Client *client;
 
 private:
-  char _bearerToken[200];
-  const char *_refreshToken;
+  SpotifyAccount _defaultAccount;
+  SpotifyAccount *_account = &_defaultAccount;
   const char *_clientId;
   const char *_clientSecret;
-  unsigned int timeTokenRefreshed;
-  unsigned int tokenTimeToLiveMs;
-  int getContentLength();
+  bool parseAccessToken(unsigned long requestTime);
+  void setTokenExpiry(long expiresInSeconds, unsigned long refreshTime);
+  bool setBearerToken(const char *accessToken);
+  void storeAccessToken(const char *accessToken, long expiresInSeconds);
+  char _connectedHost[50];
+  unsigned long _lastActivityTime = 0;
+  SpotifyHttpRequest _request;
+  SpotifyHttpResponse _response;
+  SpotifyGzipStream _gzipStream;
+  bool _gzipUnavailable = false;
+  Stream &getBody();
+#ifdef SPOTIFY_STATS
+  SpotifyRequestStats _stats;
+  unsigned long _statsStartTime = 0;
+  void startRequestStats();
+  void recordResponseStats(unsigned long sentTime);
+  void recordParseStats(JsonDocument &doc, unsigned long parseStart);
+  void recordFreeHeap();
+#endif
+  bool connectClient(const char *host, bool *reused);
+  int sendRequestWithBody(const char *type, const char *command, const char *authorization, const char *body, const char *contentType, const char *host, bool *reused);
+  int sendGetRequest(const char *command, const char *authorization, const char *accept, const char *host, bool *reused, const char *ifNoneMatch = NULL);
+  void addGetRequest(const char *command, const char *authorization, const char *accept, const char *host, const char *ifNoneMatch);
+  void buildCurrentlyPlayingCommand(char *command, size_t size, const char *market);
+  void buildPlayerDetailsCommand(char *command, size_t size, const char *market);
+  void addQueryParameter(char *command, size_t size, const char *name, const char *value);
+  int requestCurrentlyPlaying(CurrentlyPlaying &currentlyPlaying, const char *market, bool detectChanges);
+  int parseCurrentlyPlaying(CurrentlyPlaying &currentlyPlaying, bool detectChanges);
+  bool hasCurrentlyPlayingChanged(const char *trackUri, bool isPlaying, long progressMs);
+  bool parsePlayerDetails(PlayerDetails &playerDetails);
+  bool parsePlayerSnapshot(PlayerSnapshot &snapshot);
+  void addCurrentlyPlayingFilter(JsonDocument &filter);
+  void addPlayerDetailsFilter(JsonDocument &filter);
+  void readCurrentlyPlaying(JsonDocument &doc, CurrentlyPlaying &currentlyPlaying);
+  void readPlayerDetails(JsonDocument &doc, PlayerDetails &playerDetails);
+  SpotifyAudioFeaturesCache *_audioFeaturesCache = NULL;
+  const char *getTrackId(const char *uri);
+  void addAudioFeaturesFilter(JsonDocument &filter);
+  void readAudioFeatures(JsonDocument &doc, AudioFeatures &audioFeatures);
+  int requestAudioFeatures(const char *command, const char **uris, int count, processTrackAudioFeatures audioFeaturesCallback);
+  void failAudioFeatures(const char **uris, int count, processTrackAudioFeatures audioFeaturesCallback);
+  bool parseAudioFeatures(AudioFeatures &audioFeatures, const char *trackId);
+  int sendPipelinedRequests(SpotifyPipeline &pipeline, bool *pending, bool *reused);
+  int _pagingTotal = -1;
+  int getPagedTracks(const char *command, const char *itemsKey, bool wrapped, bool paged, processTrack trackCallback, int offset, int count);
+  void buildPagePath(char *path, size_t size, const char *command, int offset, int limit);
+  bool readTrackPage(Stream &body, const char *itemsKey, bool wrapped, processTrack trackCallback, int index, int maxTracks, int *trackCount, bool *hasNext, bool *stopped);
+  bool readTracks(Stream &body, bool wrapped, processTrack trackCallback, int index, int maxTracks, int *trackCount, bool *stopped);
+  int waitForJson(Stream &body);
+  int peekJson(Stream &body);
+  int readJsonChar(Stream &body);
+  bool readJsonString(Stream &body, char *value, size_t size);
+  bool skipJsonValue(Stream &body, char *value, size_t size);
+  int readPipelinedResponse(SpotifyPipeline &pipeline, int index, int statusCode);
+  SpotifyAsyncState _asyncState = spotify_async_idle;
+  SpotifyAsyncRequestType _asyncRequestType;
+  processCurrentlyPlaying _asyncCurrentlyPlayingCallback;
+  processPlayerDetails _asyncPlayerDetailsCallback;
+  int _asyncStatusCode = -1;
+  int _playerCommandStatusCode = -1;
+  unsigned long _asyncLastActivityTime;
+  unsigned long _asyncRequestTime;
+  bool _asyncInBackground = false;
+  bool startAsyncRequest(const char *command, SpotifyAsyncRequestType requestType);
+  void addDeviceId(char *command, size_t size, const char *deviceId);
+  void waitForAsyncResponse(SpotifyAsyncRequestType requestType);
+  void parseAsyncBody();
+  void finishRequestInProgress();
+  void finishAsyncRequest();
+  uint8_t *_imageBuffer = NULL;
+  size_t _imageBufferLength = 0;
+  bool _ownsImageBuffer = false;
+  ImageTransferInfo _lastImageTransfer = {0, 0, 0};
+  unsigned long _imageRequestTime = 0;
+  uint8_t *getImageBuffer(size_t *size);
+  bool startImageRequest(char *imageUrl);
+  bool readImageBody(Stream *file, uint8_t *imageData, processImageData imageDataCallback);
   int getHttpStatusCode();
-  void skipHeaders(bool tossUnexpectedForJSON = true);
   void closeClient();
+  void copyString(char *dest, const char *src, size_t destSize);
   void parseError();
   const char *requestAccessTokensBody =
       R"(grant_type=authorization_code&code=%s&redirect_uri=%s&client_id=%s&client_secret=%s)";
@@ -0,0 +1,124 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "SpotifyAccounts.h"
+
+SpotifyAccounts::SpotifyAccounts(ArduinoSpotify &spotify)
+{
+    this->_spotify = &spotify;
+}
+
+int SpotifyAccounts::addAccount(const char *refreshToken)
+{
+    if (_count >= SPOTIFY_MAX_ACCOUNTS)
+        {
+            return -1;
+        }
+    
+    _spotify->initAccount(_accounts[_count], refreshToken);
+    _polled[_count] = false;
+    return _count++;
+}
+
+int SpotifyAccounts::getCount()
+{
+    return _count;
+}
+
+SpotifyAccount *SpotifyAccounts::getAccount(int index)
+{
+    if (index < 0 || index >= _count)
+        {
+            return NULL;
+        }
+    return &_accounts[index];
+}
+
+bool SpotifyAccounts::selectAccount(int index)
+{
+    SpotifyAccount *account = getAccount(index);
+    if (account == NULL || !_spotify->setAccount(account))
+        {
+            return false;
+        }
+    _selected = index;
+    return true;
+}
+
+int SpotifyAccounts::getSelectedAccount()
+{
+    return _selected;
+}
+
+int SpotifyAccounts::loop()
+{
+    if (_count == 0 || _spotify->isRequestInProgress())
+        {
+            return -1;
+        }
+    
+    unsigned long now = millis();
+    if (_madeRequest && now - _lastRequestTime < pollIntervalMs / _count)
+        {
+            return -1;
+        }
+    
+    // Each account has to be selected to check it, the sketch's choice
+    // is put back afterwards so its player controls go to the right user
+    SpotifyAccount *selected = _spotify->getAccount();
+    int handled = -1;
+    
+    // Starting after whoever went last, so an account that is always due
+    // (e.g. its token keeps failing) can't hold up the others
+    for (int i = 0; i < _count && handled < 0; i++)
+        {
+            int index = (_next + i) % _count;
+            _spotify->setAccount(&_accounts[index]);
+            
+            bool tokenRefreshDue = _spotify->autoTokenRefresh && _spotify->isTokenRefreshDue();
+            if (!tokenRefreshDue && _polled[index] && now - _lastPollTime[index] < pollIntervalMs)
+                {
+                    continue;
+                }
+            
+            _next = (index + 1) % _count;
+            _lastRequestTime = now;
+            _madeRequest = true;
+            handled = index;
+            if (tokenRefreshDue)
+                {
+                    _spotify->refreshAccessToken();
+                }
+            else
+                {
+                    _lastPollTime[index] = now;
+                    _polled[index] = true;
+                    CurrentlyPlaying currentlyPlaying;
+                    int statusCode = _spotify->getCurrentlyPlaying(currentlyPlaying, market);
+                    if (currentlyPlayingCallback != NULL)
+                        {
+                            currentlyPlayingCallback(index, statusCode, currentlyPlaying);
+                        }
+                }
+        }
+    
+    _spotify->setAccount(selected);
+    return handled;
+}
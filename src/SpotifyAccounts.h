@@ -0,0 +1,77 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef SpotifyAccounts_h
+#define SpotifyAccounts_h
+
+#include <Arduino.h>
+#include "ArduinoSpotify.h"
+
+// Most accounts in one SpotifyAccounts
+#define SPOTIFY_MAX_ACCOUNTS 4
+
+// currentlyPlaying is only filled in when statusCode is 200
+typedef void (*processAccountCurrentlyPlaying)(int account, int statusCode, CurrentlyPlaying &currentlyPlaying);
+
+// Several users on one ArduinoSpotify, so they share its client and its
+// kept alive connection instead of each needing their own. Each account
+// only costs its SpotifyAccount. loop() takes turns between them, so they
+// are all polled equally often, and spreads the requests (including
+// token refreshes) out instead of making them all at once.
+class SpotifyAccounts
+{
+public:
+  SpotifyAccounts(ArduinoSpotify &spotify);
+
+  // Returns the new account's index, -1 if there is no room
+  int addAccount(const char *refreshToken);
+  int getCount();
+  SpotifyAccount *getAccount(int index);
+  // Makes the ArduinoSpotify methods act for this account, e.g. to
+  // control its player. False while a non-blocking request is running.
+  bool selectAccount(int index);
+  int getSelectedAccount();
+
+  // Call from loop(). Makes at most one request, for the next account in
+  // turn that needs one: renewing its token if that is due, otherwise
+  // getting its currently playing track once pollIntervalMs has passed
+  // since the last time. Requests are at least pollIntervalMs divided by
+  // the number of accounts apart. Returns the index of the account the
+  // request was for, -1 if nothing was due. Whichever account was
+  // selected before is selected again afterwards.
+  int loop();
+
+  unsigned long pollIntervalMs = 10000;
+  const char *market = "";
+  processAccountCurrentlyPlaying currentlyPlayingCallback = NULL;
+
+private:
+  ArduinoSpotify *_spotify;
+  SpotifyAccount _accounts[SPOTIFY_MAX_ACCOUNTS];
+  unsigned long _lastPollTime[SPOTIFY_MAX_ACCOUNTS];
+  bool _polled[SPOTIFY_MAX_ACCOUNTS];
+  int _count = 0;
+  int _selected = -1;
+  int _next = 0;
+  unsigned long _lastRequestTime = 0;
+  bool _madeRequest = false;
+};
+
+#endif
@@ -0,0 +1,92 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "SpotifyAudioFeaturesCache.h"
+
+SpotifyAudioFeaturesCache::SpotifyAudioFeaturesCache()
+{
+    clear();
+}
+
+const AudioFeatures *SpotifyAudioFeaturesCache::get(const char *trackId)
+{
+    int index = findTrack(trackId);
+    if (index < 0)
+        {
+            return NULL;
+        }
+    
+    _tracks[index].lastUsed = ++_useCount;
+    return &_tracks[index].audioFeatures;
+}
+
+void SpotifyAudioFeaturesCache::put(const char *trackId, const AudioFeatures &audioFeatures)
+{
+    if (trackId == NULL || trackId[0] == '\0' || strlen(trackId) >= SPOTIFY_TRACK_ID_CHAR_LENGTH)
+        {
+            return;
+        }
+    
+    int index = findTrack(trackId);
+    if (index < 0)
+        {
+            // A free slot, otherwise the one unused for longest
+            index = 0;
+            for (int i = 0; i < SPOTIFY_AUDIO_FEATURES_CACHE_SIZE; i++)
+                {
+                    if (_tracks[i].trackId[0] == '\0')
+                        {
+                            index = i;
+                            break;
+                        }
+                    if (_tracks[i].lastUsed < _tracks[index].lastUsed)
+                        {
+                            index = i;
+                        }
+                }
+            strcpy(_tracks[index].trackId, trackId);
+        }
+    
+    _tracks[index].audioFeatures = audioFeatures;
+    _tracks[index].lastUsed = ++_useCount;
+}
+
+void SpotifyAudioFeaturesCache::clear()
+{
+    memset(_tracks, 0, sizeof(_tracks));
+    _useCount = 0;
+}
+
+int SpotifyAudioFeaturesCache::findTrack(const char *trackId)
+{
+    if (trackId == NULL || trackId[0] == '\0')
+        {
+            return -1;
+        }
+    
+    for (int i = 0; i < SPOTIFY_AUDIO_FEATURES_CACHE_SIZE; i++)
+        {
+            if (strcmp(_tracks[i].trackId, trackId) == 0)
+                {
+                    return i;
+                }
+        }
+    return -1;
+}
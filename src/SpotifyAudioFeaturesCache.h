@@ -0,0 +1,59 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef SpotifyAudioFeaturesCache_h
+#define SpotifyAudioFeaturesCache_h
+
+#include <Arduino.h>
+#include "ArduinoSpotify.h"
+
+// How many tracks' audio features are kept
+#define SPOTIFY_AUDIO_FEATURES_CACHE_SIZE 16
+
+struct SpotifyCachedAudioFeatures
+{
+  char trackId[SPOTIFY_TRACK_ID_CHAR_LENGTH]; // Empty if the slot is free
+  unsigned long lastUsed;
+  AudioFeatures audioFeatures;
+};
+
+// Audio features for a track never change, so once fetched they can be
+// kept. Give one to ArduinoSpotify::setAudioFeaturesCache() and
+// getAudioFeatures() (including the batch version and getPlayerSnapshot())
+// only asks Spotify about tracks it doesn't have. The least recently used
+// track is dropped when it is full.
+class SpotifyAudioFeaturesCache
+{
+public:
+  SpotifyAudioFeaturesCache();
+
+  // NULL if the track isn't cached
+  const AudioFeatures *get(const char *trackId);
+  void put(const char *trackId, const AudioFeatures &audioFeatures);
+  void clear();
+
+private:
+  SpotifyCachedAudioFeatures _tracks[SPOTIFY_AUDIO_FEATURES_CACHE_SIZE];
+  unsigned long _useCount = 0;
+
+  int findTrack(const char *trackId);
+};
+
+#endif
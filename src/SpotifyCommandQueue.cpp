@@ -0,0 +1,192 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "SpotifyCommandQueue.h"
+
+SpotifyCommandQueue::SpotifyCommandQueue(ArduinoSpotify &spotify)
+{
+    this->_spotify = &spotify;
+    clear();
+}
+
+void SpotifyCommandQueue::play()
+{
+    queue(spotify_command_playback, 1);
+}
+
+void SpotifyCommandQueue::pause()
+{
+    queue(spotify_command_playback, 0);
+}
+
+void SpotifyCommandQueue::setVolume(int volume)
+{
+    queue(spotify_command_volume, volume);
+}
+
+void SpotifyCommandQueue::seek(int positionMs)
+{
+    queue(spotify_command_seek, positionMs);
+}
+
+void SpotifyCommandQueue::nextTrack()
+{
+    queue(spotify_command_skip, _commands[spotify_command_skip].value + 1);
+}
+
+void SpotifyCommandQueue::previousTrack()
+{
+    queue(spotify_command_skip, _commands[spotify_command_skip].value - 1);
+}
+
+void SpotifyCommandQueue::toggleShuffle(bool shuffle)
+{
+    queue(spotify_command_shuffle, shuffle ? 1 : 0);
+}
+
+void SpotifyCommandQueue::setRepeatMode(RepeatOptions repeat)
+{
+    queue(spotify_command_repeat, (int)repeat);
+}
+
+bool SpotifyCommandQueue::loop()
+{
+    if (_spotify->isRequestInProgress())
+        {
+            // Either our command or something else, like a token refresh
+            if (_spotify->poll())
+                {
+                    return true;
+                }
+        }
+    
+    if (_sending)
+        {
+            _sending = false;
+            reportComplete(_sendingCommand, _spotify->getPlayerCommandStatusCode());
+        }
+    
+    int command = nextCommand();
+    if (command < 0)
+        {
+            // Nothing to send, let it renew the token if that's due
+            return _spotify->poll();
+        }
+    
+    if (!sendCommand((SpotifyCommandType)command))
+        {
+            reportComplete((SpotifyCommandType)command, -1);
+        }
+    return true;
+}
+
+bool SpotifyCommandQueue::isEmpty()
+{
+    return !_sending && nextCommand() < 0;
+}
+
+void SpotifyCommandQueue::clear()
+{
+    memset(_commands, 0, sizeof(_commands));
+}
+
+void SpotifyCommandQueue::queue(SpotifyCommandType command, int value)
+{
+    _commands[command].value = value;
+    // Next and previous can cancel each other out
+    _commands[command].pending = command != spotify_command_skip || value != 0;
+    _commands[command].order = ++_orderCount;
+}
+
+int SpotifyCommandQueue::nextCommand()
+{
+    int next = -1;
+    for (int i = 0; i < spotify_command_count; i++)
+        {
+            if (_commands[i].pending && (next < 0 || _commands[i].order < _commands[next].order))
+                {
+                    next = i;
+                }
+        }
+    return next;
+}
+
+bool SpotifyCommandQueue::sendCommand(SpotifyCommandType command)
+{
+    SpotifyQueuedCommand *queued = &_commands[command];
+    char path[SPOTIFY_PATH_LENGTH];
+    const char *method = "PUT ";
+    
+    // Taken off the queue now, so anything that comes in while it is
+    // being sent is queued again rather than lost.
+    queued->pending = false;
+    switch (command)
+        {
+            case spotify_command_playback:
+                strcpy(path, queued->value ? SPOTIFY_PLAY_ENDPOINT : SPOTIFY_PAUSE_ENDPOINT);
+                break;
+            case spotify_command_volume:
+                snprintf(path, sizeof(path), SPOTIFY_VOLUME_ENDPOINT, queued->value);
+                break;
+            case spotify_command_seek:
+                snprintf(path, sizeof(path), SPOTIFY_SEEK_ENDPOINT "?position_ms=%d", queued->value);
+                break;
+            case spotify_command_skip:
+                // One track per request, the rest stay queued
+                method = "POST ";
+                if (queued->value > 0)
+                    {
+                        strcpy(path, SPOTIFY_NEXT_TRACK_ENDPOINT);
+                        queued->value--;
+                    }
+                else
+                    {
+                        strcpy(path, SPOTIFY_PREVIOUS_TRACK_ENDPOINT);
+                        queued->value++;
+                    }
+                queued->pending = queued->value != 0;
+                break;
+            case spotify_command_shuffle:
+                snprintf(path, sizeof(path), SPOTIFY_SHUFFLE_ENDPOINT, queued->value ? "true" : "false");
+                break;
+            case spotify_command_repeat:
+                snprintf(path, sizeof(path), SPOTIFY_REPEAT_ENDPOINT, queued->value == repeat_track ? "track" : (queued->value == repeat_context ? "context" : "off"));
+                break;
+            default:
+                return false;
+        }
+    
+    if (!_spotify->startPlayerCommand(method, path, deviceId))
+        {
+            return false;
+        }
+    
+    _sending = true;
+    _sendingCommand = command;
+    return true;
+}
+
+void SpotifyCommandQueue::reportComplete(SpotifyCommandType command, int statusCode)
+{
+    if (commandCompleteCallback != NULL)
+        {
+            commandCompleteCallback(command, statusCode);
+        }
+}
@@ -0,0 +1,95 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef SpotifyCommandQueue_h
+#define SpotifyCommandQueue_h
+
+#include <Arduino.h>
+#include "ArduinoSpotify.h"
+
+enum SpotifyCommandType
+{
+  spotify_command_playback, // play and pause
+  spotify_command_volume,
+  spotify_command_seek,
+  spotify_command_skip, // next and previous track
+  spotify_command_shuffle,
+  spotify_command_repeat,
+  spotify_command_count
+};
+
+typedef void (*processCommandComplete)(SpotifyCommandType command, int statusCode);
+
+struct SpotifyQueuedCommand
+{
+  bool pending;
+  // The volume, position, etc. For skips, how many tracks (negative is back)
+  int value;
+  unsigned long order;
+};
+
+// Sends player commands in the background, one at a time, without
+// blocking loop(). Commands that arrive while one is being sent replace
+// any of the same kind still waiting, so turning a volume knob quickly
+// only sends the latest volume. Skips add up instead (three presses of
+// next skip three tracks, next then previous cancel out). Waiting
+// commands are sent in the order they were last changed.
+//
+// Call loop() from loop() instead of spotify.poll(). Turn on
+// spotify.keepAlive so the commands don't each need a new connection.
+class SpotifyCommandQueue
+{
+public:
+  SpotifyCommandQueue(ArduinoSpotify &spotify);
+
+  void play();
+  void pause();
+  void setVolume(int volume);
+  void seek(int positionMs);
+  void nextTrack();
+  void previousTrack();
+  void toggleShuffle(bool shuffle);
+  void setRepeatMode(RepeatOptions repeat);
+
+  // Returns true while there is something waiting to be sent or a
+  // request in progress.
+  bool loop();
+  bool isEmpty();
+  // Drops everything still waiting (not a command already sent)
+  void clear();
+
+  const char *deviceId = "";
+  // Called with each command's status code (204 if it worked)
+  processCommandComplete commandCompleteCallback = NULL;
+
+private:
+  ArduinoSpotify *_spotify;
+  SpotifyQueuedCommand _commands[spotify_command_count];
+  unsigned long _orderCount = 0;
+  bool _sending = false;
+  SpotifyCommandType _sendingCommand;
+
+  void queue(SpotifyCommandType command, int value);
+  int nextCommand();
+  bool sendCommand(SpotifyCommandType command);
+  void reportComplete(SpotifyCommandType command, int statusCode);
+};
+
+#endif
@@ -0,0 +1,545 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "SpotifyGzipStream.h"
+
+// Most symbols in each Huffman table, and the longest code
+#define SPOTIFY_GZIP_LENGTH_SYMBOLS 288
+#define SPOTIFY_GZIP_DISTANCE_SYMBOLS 30
+#define SPOTIFY_GZIP_MAX_BITS 15
+#define SPOTIFY_GZIP_TABLES_SIZE ((2 * (SPOTIFY_GZIP_MAX_BITS + 1) + SPOTIFY_GZIP_LENGTH_SYMBOLS + SPOTIFY_GZIP_DISTANCE_SYMBOLS) * sizeof(int16_t))
+
+// From RFC 1951
+static const uint16_t lengthBase[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const uint8_t lengthExtraBits[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const uint16_t distanceBase[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+static const uint8_t distanceExtraBits[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+static const uint8_t codeLengthOrder[19] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+SpotifyGzipStream::~SpotifyGzipStream()
+{
+    free(_buffer);
+}
+
+bool SpotifyGzipStream::begin(Stream *source)
+{
+    if (_buffer == NULL)
+        {
+            _buffer = (uint8_t *)malloc(SPOTIFY_GZIP_TABLES_SIZE + SPOTIFY_GZIP_WINDOW_SIZE);
+            if (_buffer == NULL)
+                {
+                    _state = spotify_gzip_error;
+                    _peeked = -1;
+                    _copyLength = 0;
+                    setTimeout(0);
+                    return false;
+                }
+            int16_t *tables = (int16_t *)_buffer;
+            _lengthCodes.count = tables;
+            tables += SPOTIFY_GZIP_MAX_BITS + 1;
+            _lengthCodes.symbol = tables;
+            tables += SPOTIFY_GZIP_LENGTH_SYMBOLS;
+            _distanceCodes.count = tables;
+            tables += SPOTIFY_GZIP_MAX_BITS + 1;
+            _distanceCodes.symbol = tables;
+            _window = _buffer + SPOTIFY_GZIP_TABLES_SIZE;
+        }
+    
+    _source = source;
+    // Reads wait for more of the body as long as the response would,
+    // until it has ended or failed
+    setTimeout(source->getTimeout());
+    _state = spotify_gzip_header;
+    _lastBlock = false;
+    _bitBuffer = 0;
+    _bitCount = 0;
+    _windowPosition = 0;
+    _storedRemaining = 0;
+    _copyLength = 0;
+    _copyDistance = 0;
+    _peeked = -1;
+    return true;
+}
+
+bool SpotifyGzipStream::isFinished()
+{
+    return _peeked < 0 && _copyLength == 0 && (_state == spotify_gzip_done || _state == spotify_gzip_error);
+}
+
+int SpotifyGzipStream::available()
+{
+    if (_peeked >= 0 || _copyLength > 0)
+        {
+            return 1;
+        }
+    if (_state == spotify_gzip_done || _state == spotify_gzip_error)
+        {
+            return 0;
+        }
+    return (_bitCount > 0 || _source->available() > 0) ? 1 : 0;
+}
+
+int SpotifyGzipStream::read()
+{
+    if (_peeked >= 0)
+        {
+            int c = _peeked;
+            _peeked = -1;
+            return c;
+        }
+    return inflateNext();
+}
+
+int SpotifyGzipStream::peek()
+{
+    if (_peeked < 0)
+        {
+            _peeked = inflateNext();
+        }
+    return _peeked;
+}
+
+size_t SpotifyGzipStream::write(uint8_t b)
+{
+    // Only for reading
+    return 0;
+}
+
+void SpotifyGzipStream::flush()
+{
+}
+
+int SpotifyGzipStream::inflateNext()
+{
+    // Works one byte at a time, a back reference is copied out over as
+    // many calls as its length.
+    for (;;)
+        {
+            switch (_state)
+                {
+                    case spotify_gzip_header:
+                        if (!readHeader())
+                            {
+                                return fail();
+                            }
+                        _state = spotify_gzip_block_header;
+                        break;
+                    case spotify_gzip_block_header:
+                        if (_lastBlock)
+                            {
+                                _state = spotify_gzip_done;
+                                setTimeout(0);
+                                return -1;
+                            }
+                        if (!readBlockHeader())
+                            {
+                                return fail();
+                            }
+                        break;
+                    case spotify_gzip_stored:
+                        {
+                            if (_storedRemaining == 0)
+                                {
+                                    _state = spotify_gzip_block_header;
+                                    break;
+                                }
+                            int c = readSourceByte();
+                            if (c < 0)
+                                {
+                                    return fail();
+                                }
+                            _storedRemaining--;
+                            return output(c);
+                        }
+                    case spotify_gzip_huffman:
+                        {
+                            if (_copyLength > 0)
+                                {
+                                    _copyLength--;
+                                    return output(_window[(_windowPosition - _copyDistance) & (SPOTIFY_GZIP_WINDOW_SIZE - 1)]);
+                                }
+                            
+                            int symbol = decodeSymbol(_lengthCodes);
+                            if (symbol < 0)
+                                {
+                                    return fail();
+                                }
+                            if (symbol < 256)
+                                {
+                                    return output(symbol);
+                                }
+                            if (symbol == 256)
+                                {
+                                    // End of the block
+                                    _state = spotify_gzip_block_header;
+                                    break;
+                                }
+                            
+                            symbol -= 257;
+                            if (symbol >= 29)
+                                {
+                                    return fail();
+                                }
+                            unsigned int length = lengthBase[symbol] + readBits(lengthExtraBits[symbol]);
+                            symbol = decodeSymbol(_distanceCodes);
+                            if (symbol < 0 || symbol >= 30)
+                                {
+                                    return fail();
+                                }
+                            unsigned int distance = distanceBase[symbol] + readBits(distanceExtraBits[symbol]);
+                            if (_state == spotify_gzip_error)
+                                {
+                                    return -1;
+                                }
+                            if (distance > _windowPosition || distance > SPOTIFY_GZIP_WINDOW_SIZE)
+                                {
+                                    SPOTIFY_LOG_ERRORLN(F("gzip response refers back further than SPOTIFY_GZIP_WINDOW_SIZE"));
+                                    return fail();
+                                }
+                            _copyLength = length;
+                            _copyDistance = distance;
+                            break;
+                        }
+                    default:
+                        return -1;
+                }
+        }
+}
+
+bool SpotifyGzipStream::readHeader()
+{
+    // ID1, ID2 and the compression method, which is always deflate
+    if (readSourceByte() != 0x1F || readSourceByte() != 0x8B || readSourceByte() != 8)
+        {
+            return false;
+        }
+    int flags = readSourceByte();
+    if (flags < 0)
+        {
+            return false;
+        }
+    
+    // Modification time, extra flags and OS
+    for (int i = 0; i < 6; i++)
+        {
+            if (readSourceByte() < 0)
+                {
+                    return false;
+                }
+        }
+    
+    // The optional fields aren't used, just skipped
+    if (flags & 0x04)
+        {
+            int low = readSourceByte();
+            int high = readSourceByte();
+            if (low < 0 || high < 0)
+                {
+                    return false;
+                }
+            for (int i = low | (high << 8); i > 0; i--)
+                {
+                    if (readSourceByte() < 0)
+                        {
+                            return false;
+                        }
+                }
+        }
+    for (int flag = 0x08; flag <= 0x10; flag <<= 1)
+        {
+            // File name and comment, both zero terminated
+            if (flags & flag)
+                {
+                    int c;
+                    while ((c = readSourceByte()) > 0)
+                        {
+                        }
+                    if (c < 0)
+                        {
+                            return false;
+                        }
+                }
+        }
+    if (flags & 0x02)
+        {
+            if (readSourceByte() < 0 || readSourceByte() < 0)
+                {
+                    return false;
+                }
+        }
+    return true;
+}
+
+bool SpotifyGzipStream::readBlockHeader()
+{
+    _lastBlock = readBits(1);
+    uint32_t type = readBits(2);
+    if (_state == spotify_gzip_error)
+        {
+            return false;
+        }
+    
+    switch (type)
+        {
+            case 0:
+                {
+                    // Stored as is, starting on the next byte
+                    _bitBuffer = 0;
+                    _bitCount = 0;
+                    uint32_t length = readBits(16);
+                    uint32_t lengthComplement = readBits(16);
+                    if (_state == spotify_gzip_error || length != (~lengthComplement & 0xFFFF))
+                        {
+                            return false;
+                        }
+                    _storedRemaining = length;
+                    _state = spotify_gzip_stored;
+                    return true;
+                }
+            case 1:
+                buildFixedTables();
+                _state = spotify_gzip_huffman;
+                return true;
+            case 2:
+                if (!readDynamicTables())
+                    {
+                        return false;
+                    }
+                _state = spotify_gzip_huffman;
+                return true;
+            default:
+                return false;
+        }
+}
+
+bool SpotifyGzipStream::readDynamicTables()
+{
+    uint8_t lengths[SPOTIFY_GZIP_LENGTH_SYMBOLS + SPOTIFY_GZIP_DISTANCE_SYMBOLS + 2];
+    int lengthCount = readBits(5) + 257;
+    int distanceCount = readBits(5) + 1;
+    int codeLengthCount = readBits(4) + 4;
+    if (_state == spotify_gzip_error || lengthCount > 286 || distanceCount > SPOTIFY_GZIP_DISTANCE_SYMBOLS)
+        {
+            return false;
+        }
+    
+    // The lengths are themselves Huffman coded. That table is only needed
+    // until they have been read, so it borrows the distance table's space.
+    for (int i = 0; i < 19; i++)
+        {
+            lengths[codeLengthOrder[i]] = i < codeLengthCount ? readBits(3) : 0;
+        }
+    if (_state == spotify_gzip_error || !buildTable(_distanceCodes, lengths, 19))
+        {
+            return false;
+        }
+    
+    int index = 0;
+    while (index < lengthCount + distanceCount)
+        {
+            int symbol = decodeSymbol(_distanceCodes);
+            if (symbol < 0)
+                {
+                    return false;
+                }
+            if (symbol < 16)
+                {
+                    lengths[index++] = symbol;
+                    continue;
+                }
+            
+            // 16 repeats the last length, 17 and 18 are runs of zeros
+            uint8_t length = 0;
+            int repeat;
+            if (symbol == 16)
+                {
+                    if (index == 0)
+                        {
+                            return false;
+                        }
+                    length = lengths[index - 1];
+                    repeat = 3 + readBits(2);
+                }
+            else if (symbol == 17)
+                {
+                    repeat = 3 + readBits(3);
+                }
+            else
+                {
+                    repeat = 11 + readBits(7);
+                }
+            if (_state == spotify_gzip_error || index + repeat > lengthCount + distanceCount)
+                {
+                    return false;
+                }
+            while (repeat-- > 0)
+                {
+                    lengths[index++] = length;
+                }
+        }
+    
+    // There has to be a code for the end of the block
+    if (lengths[256] == 0)
+        {
+            return false;
+        }
+    return buildTable(_lengthCodes, lengths, lengthCount) && buildTable(_distanceCodes, lengths + lengthCount, distanceCount);
+}
+
+void SpotifyGzipStream::buildFixedTables()
+{
+    uint8_t lengths[SPOTIFY_GZIP_LENGTH_SYMBOLS];
+    for (int i = 0; i < SPOTIFY_GZIP_LENGTH_SYMBOLS; i++)
+        {
+            lengths[i] = i < 144 ? 8 : (i < 256 ? 9 : (i < 280 ? 7 : 8));
+        }
+    buildTable(_lengthCodes, lengths, SPOTIFY_GZIP_LENGTH_SYMBOLS);
+    
+    for (int i = 0; i < SPOTIFY_GZIP_DISTANCE_SYMBOLS; i++)
+        {
+            lengths[i] = 5;
+        }
+    buildTable(_distanceCodes, lengths, SPOTIFY_GZIP_DISTANCE_SYMBOLS);
+}
+
+bool SpotifyGzipStream::buildTable(SpotifyHuffmanTable &table, const uint8_t *lengths, int count)
+{
+    for (int length = 0; length <= SPOTIFY_GZIP_MAX_BITS; length++)
+        {
+            table.count[length] = 0;
+        }
+    for (int symbol = 0; symbol < count; symbol++)
+        {
+            table.count[lengths[symbol]]++;
+        }
+    
+    // Too many codes of some length can't be decoded
+    int left = 1;
+    for (int length = 1; length <= SPOTIFY_GZIP_MAX_BITS; length++)
+        {
+            left <<= 1;
+            left -= table.count[length];
+            if (left < 0)
+                {
+                    return false;
+                }
+        }
+    
+    // Symbols sorted by code length, then by value, which is code order
+    int16_t offsets[SPOTIFY_GZIP_MAX_BITS + 1];
+    offsets[1] = 0;
+    for (int length = 1; length < SPOTIFY_GZIP_MAX_BITS; length++)
+        {
+            offsets[length + 1] = offsets[length] + table.count[length];
+        }
+    for (int symbol = 0; symbol < count; symbol++)
+        {
+            if (lengths[symbol] != 0)
+                {
+                    table.symbol[offsets[lengths[symbol]]++] = symbol;
+                }
+        }
+    return true;
+}
+
+int SpotifyGzipStream::decodeSymbol(SpotifyHuffmanTable &table)
+{
+    // Codes are sent most significant bit first, so they're read a bit
+    // at a time and compared against the first code of each length.
+    int code = 0;
+    int first = 0;
+    int index = 0;
+    for (int length = 1; length <= SPOTIFY_GZIP_MAX_BITS; length++)
+        {
+            code |= readBits(1);
+            if (_state == spotify_gzip_error)
+                {
+                    return -1;
+                }
+            int count = table.count[length];
+            if (code - count < first)
+                {
+                    return table.symbol[index + (code - first)];
+                }
+            index += count;
+            first += count;
+            first <<= 1;
+            code <<= 1;
+        }
+    return -1;
+}
+
+int SpotifyGzipStream::readSourceByte()
+{
+    uint8_t c;
+    if (_source->readBytes(&c, 1) != 1)
+        {
+            return -1;
+        }
+    return c;
+}
+
+uint32_t SpotifyGzipStream::readBits(uint8_t count)
+{
+    while (_bitCount < count)
+        {
+            // Don't wait on the source again once it has failed
+            int c = _state != spotify_gzip_error ? readSourceByte() : -1;
+            if (c < 0)
+                {
+                    _state = spotify_gzip_error;
+                    return 0;
+                }
+            _bitBuffer |= (uint32_t)c << _bitCount;
+            _bitCount += 8;
+        }
+    
+    uint32_t value = _bitBuffer & ((1UL << count) - 1);
+    _bitBuffer >>= count;
+    _bitCount -= count;
+    return value;
+}
+
+uint8_t SpotifyGzipStream::output(uint8_t b)
+{
+    _window[_windowPosition & (SPOTIFY_GZIP_WINDOW_SIZE - 1)] = b;
+    _windowPosition++;
+    return b;
+}
+
+int SpotifyGzipStream::fail()
+{
+    if (_state != spotify_gzip_error)
+        {
+            SPOTIFY_LOG_ERRORLN(F("Invalid gzip response"));
+        }
+    _state = spotify_gzip_error;
+    setTimeout(0);
+    return -1;
+}
@@ -0,0 +1,108 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef SpotifyGzipStream_h
+#define SpotifyGzipStream_h
+
+#include <Arduino.h>
+#include "SpotifyLog.h"
+
+// How far back a gzipped response can refer to, a power of 2. The server
+// can use up to 32KB, but a response never refers back further than its
+// own length, so a smaller window works for responses (once inflated)
+// smaller than it. Anything that needs more fails to parse.
+#ifndef SPOTIFY_GZIP_WINDOW_SIZE
+#ifdef ESP8266
+#define SPOTIFY_GZIP_WINDOW_SIZE 16384
+#else
+#define SPOTIFY_GZIP_WINDOW_SIZE 32768
+#endif
+#endif
+
+struct SpotifyHuffmanTable
+{
+  int16_t *count;  // Number of codes of each length
+  int16_t *symbol; // Symbols ordered by code
+};
+
+enum SpotifyGzipState
+{
+  spotify_gzip_header,
+  spotify_gzip_block_header,
+  spotify_gzip_stored,
+  spotify_gzip_huffman,
+  spotify_gzip_done,
+  spotify_gzip_error
+};
+
+// Inflates a gzipped body as it is read, so it can go straight into
+// deserializeJson(). The window and the Huffman tables are allocated
+// together the first time they are needed and kept for the next response.
+// The CRC at the end isn't checked, TLS already makes sure nothing was
+// changed on the way.
+class SpotifyGzipStream : public Stream
+{
+public:
+  ~SpotifyGzipStream();
+
+  // Start on a new body, false if there isn't the memory for it (it then
+  // reads as empty)
+  bool begin(Stream *source);
+  // True once the whole body has been inflated, or it turned out not to
+  // be valid gzip. Nothing more is coming then, however long you wait.
+  bool isFinished();
+
+  // Stream methods, these return the inflated body
+  int available();
+  int read();
+  int peek();
+  size_t write(uint8_t b);
+  void flush();
+
+private:
+  Stream *_source = NULL;
+  uint8_t *_buffer = NULL;
+  uint8_t *_window = NULL;
+  SpotifyGzipState _state = spotify_gzip_done;
+  bool _lastBlock = false;
+  uint32_t _bitBuffer = 0;
+  uint8_t _bitCount = 0;
+  unsigned long _windowPosition = 0;
+  unsigned int _storedRemaining = 0;
+  unsigned int _copyLength = 0;
+  unsigned int _copyDistance = 0;
+  int _peeked = -1;
+  SpotifyHuffmanTable _lengthCodes;
+  SpotifyHuffmanTable _distanceCodes;
+
+  int inflateNext();
+  bool readHeader();
+  bool readBlockHeader();
+  bool readDynamicTables();
+  void buildFixedTables();
+  bool buildTable(SpotifyHuffmanTable &table, const uint8_t *lengths, int count);
+  int decodeSymbol(SpotifyHuffmanTable &table);
+  int readSourceByte();
+  uint32_t readBits(uint8_t count);
+  uint8_t output(uint8_t b);
+  int fail();
+};
+
+#endif
@@ -0,0 +1,124 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "SpotifyHttpRequest.h"
+
+void SpotifyHttpRequest::begin(Client *client, const char *method, const char *path, const char *host)
+{
+    if (!_holding)
+        {
+            _client = client;
+            _length = 0;
+            _bytesSent = 0;
+            _failed = false;
+        }
+    _holding = false;
+    
+    print(method);
+    print(path);
+    print(F(" HTTP/1.1\r\n"));
+    addHeader(F("Host"), host);
+}
+
+void SpotifyHttpRequest::addHeader(const __FlashStringHelper *name, const char *value)
+{
+    print(name);
+    print(F(": "));
+    print(value);
+    print(F("\r\n"));
+}
+
+void SpotifyHttpRequest::addHeader(const __FlashStringHelper *name, unsigned long value)
+{
+    print(name);
+    print(F(": "));
+    print(value);
+    print(F("\r\n"));
+}
+
+bool SpotifyHttpRequest::send(const char *body)
+{
+    end(body);
+    writeBuffer();
+    return !_failed;
+}
+
+void SpotifyHttpRequest::hold(const char *body)
+{
+    end(body);
+    _holding = true;
+}
+
+size_t SpotifyHttpRequest::write(uint8_t c)
+{
+    return write(&c, 1);
+}
+
+size_t SpotifyHttpRequest::write(const uint8_t *buffer, size_t size)
+{
+    size_t written = 0;
+    while (written < size)
+        {
+            if (_length == sizeof(_buffer))
+                {
+                    writeBuffer();
+                }
+            
+            size_t toCopy = size - written;
+            if (toCopy > sizeof(_buffer) - _length)
+                {
+                    toCopy = sizeof(_buffer) - _length;
+                }
+            memcpy(_buffer + _length, buffer + written, toCopy);
+            _length += toCopy;
+            written += toCopy;
+        }
+    return written;
+}
+
+unsigned long SpotifyHttpRequest::getBytesSent()
+{
+    return _bytesSent;
+}
+
+void SpotifyHttpRequest::end(const char *body)
+{
+    print(F("\r\n"));
+    if (body != NULL)
+        {
+            print(body);
+        }
+}
+
+void SpotifyHttpRequest::writeBuffer()
+{
+    if (_length == 0)
+        {
+            return;
+        }
+    
+    size_t written = _client->write(_buffer, _length);
+    if (written != _length)
+        {
+            _failed = true;
+        }
+    _bytesSent += written;
+    _length = 0;
+}
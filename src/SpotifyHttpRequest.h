@@ -0,0 +1,65 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef SpotifyHttpRequest_h
+#define SpotifyHttpRequest_h
+
+#include <Arduino.h>
+#include <Client.h>
+
+// The request line and headers are put together here and written to the
+// client in one go. On TLS clients every write can end up as its own
+// record and packet, so this saves a lot over printing line by line.
+// Anything that doesn't fit is written out as the buffer fills.
+#define SPOTIFY_REQUEST_BUFFER_SIZE 512
+
+class SpotifyHttpRequest : public Print
+{
+public:
+  // method includes the trailing space, e.g. "GET "
+  void begin(Client *client, const char *method, const char *path, const char *host);
+  void addHeader(const __FlashStringHelper *name, const char *value);
+  void addHeader(const __FlashStringHelper *name, unsigned long value);
+  // Ends the headers, adds the body if there is one and writes out
+  // whatever is left. False if the client didn't take all of it.
+  bool send(const char *body = NULL);
+  // Ends the request like send() but keeps it in the buffer, so the next
+  // begin() adds another request after it and they go out together.
+  void hold(const char *body = NULL);
+
+  size_t write(uint8_t c);
+  size_t write(const uint8_t *buffer, size_t size);
+  using Print::write;
+
+  unsigned long getBytesSent();
+
+private:
+  Client *_client = NULL;
+  uint8_t _buffer[SPOTIFY_REQUEST_BUFFER_SIZE];
+  size_t _length = 0;
+  unsigned long _bytesSent = 0;
+  bool _failed = false;
+  bool _holding = false;
+
+  void end(const char *body);
+  void writeBuffer();
+};
+
+#endif
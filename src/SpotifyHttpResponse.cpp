@@ -0,0 +1,430 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "SpotifyHttpResponse.h"
+
+static const char *const headerNames[spotify_header_count] = {
+    "Content-Length",
+    "Transfer-Encoding",
+    "Connection",
+    "ETag",
+    "Retry-After",
+    "Content-Encoding"};
+
+void SpotifyHttpResponse::begin(Client *client, unsigned long timeoutMs)
+{
+    _client = client;
+    setTimeout(timeoutMs);
+    _state = spotify_http_status_line;
+    _statusCode = -1;
+    _lineLength = 0;
+    _remaining = 0;
+    _connectionClose = false;
+    _bytesReceived = 0;
+    _firstByteTime = 0;
+    memset(_headers, 0, sizeof(_headers));
+}
+
+bool SpotifyHttpResponse::parseHeaders()
+{
+    while (_state == spotify_http_status_line || _state == spotify_http_headers)
+        {
+            if (!readLine())
+                {
+                    return false;
+                }
+            
+            if (_state == spotify_http_status_line)
+                {
+                    processStatusLine();
+                }
+            else if (_line[0] == '\0')
+                {
+                    // The headers are finished by an empty line
+                    startBody();
+                }
+            else
+                {
+                    processHeaderLine();
+                }
+            _lineLength = 0;
+        }
+    
+    return true;
+}
+
+bool SpotifyHttpResponse::readHeaders()
+{
+    unsigned long lastDataTime = millis();
+    while (!parseHeaders())
+        {
+            if (_client->available())
+                {
+                    lastDataTime = millis();
+                    continue;
+                }
+            if (!_client->connected() || millis() - lastDataTime > _timeout)
+                {
+                    // Without the headers there is no telling where the
+                    // response ends, so the connection can't be reused.
+                    _statusCode = -1;
+                    _connectionClose = true;
+                    _state = spotify_http_done;
+                    return false;
+                }
+            yield();
+        }
+    
+    return _statusCode > 0;
+}
+
+bool SpotifyHttpResponse::skipBody()
+{
+    if (_state == spotify_http_status_line || _state == spotify_http_headers)
+        {
+            return false;
+        }
+    
+    uint8_t buff[64];
+    unsigned long lastDataTime = millis();
+    while (!isBodyComplete())
+        {
+            if (_client->available())
+                {
+                    lastDataTime = millis();
+                    read(buff, sizeof(buff));
+                }
+            else if (!_client->connected() || millis() - lastDataTime > _timeout)
+                {
+                    return false;
+                }
+            else
+                {
+                    yield();
+                }
+        }
+    
+    return true;
+}
+
+int SpotifyHttpResponse::getStatusCode()
+{
+    return _statusCode;
+}
+
+const char *SpotifyHttpResponse::getHeader(SpotifyHttpHeader header)
+{
+    return _headers[header];
+}
+
+long SpotifyHttpResponse::getContentLength()
+{
+    if (_headers[spotify_header_content_length][0] == '\0')
+        {
+            return -1;
+        }
+    return atol(_headers[spotify_header_content_length]);
+}
+
+bool SpotifyHttpResponse::isChunked()
+{
+    // chunked is always the last encoding listed
+    const char *value = _headers[spotify_header_transfer_encoding];
+    size_t length = strlen(value);
+    return length >= 7 && strcasecmp(value + length - 7, "chunked") == 0;
+}
+
+bool SpotifyHttpResponse::isBodyComplete()
+{
+    advance();
+    if (_state == spotify_http_body_until_close && !_client->connected() && !_client->available())
+        {
+            _state = spotify_http_done;
+        }
+    return _state == spotify_http_done;
+}
+
+bool SpotifyHttpResponse::canReuseConnection()
+{
+    return _state == spotify_http_done && !_connectionClose;
+}
+
+unsigned long SpotifyHttpResponse::getBytesReceived()
+{
+    return _bytesReceived;
+}
+
+unsigned long SpotifyHttpResponse::getFirstByteTime()
+{
+    return _firstByteTime;
+}
+
+int SpotifyHttpResponse::available()
+{
+    advance();
+    switch (_state)
+        {
+            case spotify_http_body_length:
+            case spotify_http_chunk_data:
+                {
+                    unsigned long clientAvailable = _client->available();
+                    return clientAvailable < _remaining ? clientAvailable : _remaining;
+                }
+            case spotify_http_body_until_close:
+                return _client->available();
+            default:
+                return 0;
+        }
+}
+
+int SpotifyHttpResponse::read()
+{
+    if (available() <= 0)
+        {
+            return -1;
+        }
+    
+    int c = _client->read();
+    if (c >= 0)
+        {
+            _bytesReceived++;
+            if (_state != spotify_http_body_until_close)
+                {
+                    _remaining--;
+                }
+        }
+    return c;
+}
+
+int SpotifyHttpResponse::read(uint8_t *buffer, size_t size)
+{
+    size_t bodyAvailable = available();
+    if (bodyAvailable == 0)
+        {
+            return 0;
+        }
+    
+    int bytesRead = _client->read(buffer, size < bodyAvailable ? size : bodyAvailable);
+    if (bytesRead > 0)
+        {
+            _bytesReceived += bytesRead;
+            if (_state != spotify_http_body_until_close)
+                {
+                    _remaining -= bytesRead;
+                }
+        }
+    return bytesRead;
+}
+
+int SpotifyHttpResponse::peek()
+{
+    if (available() <= 0)
+        {
+            return -1;
+        }
+    return _client->peek();
+}
+
+size_t SpotifyHttpResponse::write(uint8_t b)
+{
+    // A response can only be read
+    return 0;
+}
+
+void SpotifyHttpResponse::flush()
+{
+}
+
+bool SpotifyHttpResponse::readLine()
+{
+    // Only reads what has already arrived. Long lines are cut short, we
+    // only care about the start of them.
+    while (_client->available())
+        {
+            int c = _client->read();
+            if (c < 0)
+                {
+                    break;
+                }
+            if (_bytesReceived++ == 0)
+                {
+                    _firstByteTime = millis();
+                }
+            if (c == '\n')
+                {
+                    size_t length = _lineLength < sizeof(_line) ? _lineLength : sizeof(_line) - 1;
+                    if (length > 0 && _line[length - 1] == '\r')
+                        {
+                            length--;
+                        }
+                    _line[length] = '\0';
+                    return true;
+                }
+            if (_lineLength < sizeof(_line) - 1)
+                {
+                    _line[_lineLength] = c;
+                }
+            _lineLength++;
+        }
+    
+    return false;
+}
+
+void SpotifyHttpResponse::processStatusLine()
+{
+    // e.g. "HTTP/1.1 200 OK"
+    char *space = strchr(_line, ' ');
+    if (strncmp(_line, "HTTP/", 5) != 0 || space == NULL)
+        {
+            SPOTIFY_LOG_ERRORLN(F("Invalid response"));
+            _statusCode = -1;
+            _connectionClose = true;
+            _state = spotify_http_done;
+            return;
+        }
+    
+    _statusCode = atoi(space + 1);
+    SPOTIFY_LOG_DEBUG(F("Status Code: "));
+    SPOTIFY_LOG_DEBUGLN(_statusCode);
+    _state = spotify_http_headers;
+}
+
+void SpotifyHttpResponse::processHeaderLine()
+{
+    char *colon = strchr(_line, ':');
+    if (colon == NULL)
+        {
+            return;
+        }
+    
+    for (int i = 0; i < spotify_header_count; i++)
+        {
+            size_t nameLength = strlen(headerNames[i]);
+            if ((size_t)(colon - _line) == nameLength && strncasecmp(_line, headerNames[i], nameLength) == 0)
+                {
+                    const char *value = colon + 1;
+                    while (*value == ' ' || *value == '\t')
+                        {
+                            value++;
+                        }
+                    strncpy(_headers[i], value, SPOTIFY_HEADER_VALUE_LENGTH - 1);
+                    _headers[i][SPOTIFY_HEADER_VALUE_LENGTH - 1] = '\0';
+                    
+                    size_t length = strlen(_headers[i]);
+                    while (length > 0 && (_headers[i][length - 1] == ' ' || _headers[i][length - 1] == '\t'))
+                        {
+                            _headers[i][--length] = '\0';
+                        }
+                    return;
+                }
+        }
+}
+
+void SpotifyHttpResponse::startBody()
+{
+    if (_statusCode >= 100 && _statusCode < 200)
+        {
+            // e.g. 100 Continue, the real response follows
+            memset(_headers, 0, sizeof(_headers));
+            _state = spotify_http_status_line;
+            return;
+        }
+    
+    _connectionClose = strcasecmp(_headers[spotify_header_connection], "close") == 0;
+    
+    long contentLength = getContentLength();
+    if (_statusCode == 204 || _statusCode == 304)
+        {
+            // These never have a body
+            _state = spotify_http_done;
+        }
+    else if (isChunked())
+        {
+            _state = spotify_http_chunk_size;
+        }
+    else if (contentLength >= 0)
+        {
+            _remaining = contentLength;
+            _state = contentLength > 0 ? spotify_http_body_length : spotify_http_done;
+        }
+    else
+        {
+            // The body is everything until the server closes the connection
+            _connectionClose = true;
+            _state = spotify_http_body_until_close;
+        }
+}
+
+void SpotifyHttpResponse::advance()
+{
+    // Step over any chunked framing that has arrived, so the body can be
+    // read straight from the client.
+    while (true)
+        {
+            switch (_state)
+                {
+                    case spotify_http_body_length:
+                        if (_remaining == 0)
+                            {
+                                _state = spotify_http_done;
+                            }
+                        return;
+                    case spotify_http_chunk_size:
+                        if (!readLine())
+                            {
+                                return;
+                            }
+                        // Any chunk extensions after a ';' are ignored
+                        _remaining = strtoul(_line, NULL, 16);
+                        _lineLength = 0;
+                        _state = _remaining > 0 ? spotify_http_chunk_data : spotify_http_trailers;
+                        break;
+                    case spotify_http_chunk_data:
+                        if (_remaining > 0)
+                            {
+                                return;
+                            }
+                        _state = spotify_http_chunk_end;
+                        break;
+                    case spotify_http_chunk_end:
+                        // The line ending after the chunk's data
+                        if (!readLine())
+                            {
+                                return;
+                            }
+                        _lineLength = 0;
+                        _state = spotify_http_chunk_size;
+                        break;
+                    case spotify_http_trailers:
+                        if (!readLine())
+                            {
+                                return;
+                            }
+                        if (_line[0] == '\0')
+                            {
+                                _state = spotify_http_done;
+                            }
+                        _lineLength = 0;
+                        break;
+                    default:
+                        return;
+                }
+        }
+}
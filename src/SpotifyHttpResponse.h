@@ -0,0 +1,116 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef SpotifyHttpResponse_h
+#define SpotifyHttpResponse_h
+
+#include <Arduino.h>
+#include <Client.h>
+#include "SpotifyLog.h"
+
+// Only the start of each header line is kept, enough for the ones we use
+#define SPOTIFY_HEADER_LINE_LENGTH 100
+#define SPOTIFY_HEADER_VALUE_LENGTH 64
+
+// The headers that are kept, anything else is skipped
+enum SpotifyHttpHeader
+{
+  spotify_header_content_length,
+  spotify_header_transfer_encoding,
+  spotify_header_connection,
+  spotify_header_etag,
+  spotify_header_retry_after,
+  spotify_header_content_encoding,
+  spotify_header_count
+};
+
+enum SpotifyHttpState
+{
+  spotify_http_status_line,
+  spotify_http_headers,
+  spotify_http_body_length,
+  spotify_http_body_until_close,
+  spotify_http_chunk_size,
+  spotify_http_chunk_data,
+  spotify_http_chunk_end,
+  spotify_http_trailers,
+  spotify_http_done
+};
+
+// Reads an HTTP/1.1 response from the client a piece at a time, so it
+// can be used without blocking. Once the headers are in, reading from it
+// as a Stream gives exactly the body, with any chunked encoding removed,
+// and nothing past the end of it. That leaves the connection ready for
+// the next request.
+class SpotifyHttpResponse : public Stream
+{
+public:
+  // Start on a new response
+  void begin(Client *client, unsigned long timeoutMs);
+
+  // Reads whatever has arrived of the status line and headers, returns
+  // true once they are all in.
+  bool parseHeaders();
+  // Waits for the headers, false if they didn't arrive in time
+  bool readHeaders();
+  // Reads and throws away what is left of the body
+  bool skipBody();
+
+  int getStatusCode();
+  // "" if the response didn't have it
+  const char *getHeader(SpotifyHttpHeader header);
+  // -1 if it wasn't sent (e.g. chunked)
+  long getContentLength();
+  bool isChunked();
+  bool isBodyComplete();
+  bool canReuseConnection();
+  // Everything read from the client for this response, including headers
+  unsigned long getBytesReceived();
+  // millis() when the response started arriving, 0 if it hasn't yet
+  unsigned long getFirstByteTime();
+
+  // Stream methods, these only read the body
+  int available();
+  int read();
+  int read(uint8_t *buffer, size_t size);
+  int peek();
+  size_t write(uint8_t b);
+  void flush();
+
+private:
+  Client *_client = NULL;
+  SpotifyHttpState _state = spotify_http_done;
+  int _statusCode = -1;
+  char _line[SPOTIFY_HEADER_LINE_LENGTH];
+  size_t _lineLength = 0;
+  char _headers[spotify_header_count][SPOTIFY_HEADER_VALUE_LENGTH];
+  unsigned long _remaining = 0;
+  bool _connectionClose = false;
+  unsigned long _bytesReceived = 0;
+  unsigned long _firstByteTime = 0;
+
+  bool readLine();
+  void processStatusLine();
+  void processHeaderLine();
+  void startBody();
+  void advance();
+};
+
+#endif
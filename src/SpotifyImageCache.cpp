@@ -0,0 +1,299 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "SpotifyImageCache.h"
+
+SpotifyImageCache::SpotifyImageCache(ArduinoSpotify &spotify)
+{
+    _spotify = &spotify;
+    memset(_files, 0, sizeof(_files));
+    memset(_ram, 0, sizeof(_ram));
+}
+
+SpotifyImageCache::SpotifyImageCache(ArduinoSpotify &spotify, openImageStream openStream, closeImageStream closeStream, removeImageStream removeStream)
+{
+    _spotify = &spotify;
+    _openStream = openStream;
+    _closeStream = closeStream;
+    _removeStream = removeStream;
+    memset(_files, 0, sizeof(_files));
+    memset(_ram, 0, sizeof(_ram));
+}
+
+SpotifyImageCache::~SpotifyImageCache()
+{
+    for (int i = 0; i < SPOTIFY_IMAGE_CACHE_RAM_SIZE; i++)
+        {
+            free(_ram[i].data);
+        }
+}
+
+int SpotifyImageCache::getImage(char *imageUrl, const uint8_t **imageData)
+{
+    uint32_t urlHash = hashUrl(imageUrl);
+    
+    int index = findImage(_ram, SPOTIFY_IMAGE_CACHE_RAM_SIZE, urlHash);
+    if (index >= 0)
+        {
+            SPOTIFY_LOG_DEBUGLN(F("Image cache: found in RAM"));
+            _ram[index].lastUsed = ++_useCount;
+            *imageData = _ram[index].data;
+            return _ram[index].size;
+        }
+    
+    uint8_t *data = NULL;
+    int size = -1;
+    
+    index = findImage(_files, SPOTIFY_IMAGE_CACHE_SIZE, urlHash);
+    if (index >= 0)
+        {
+            SPOTIFY_LOG_DEBUGLN(F("Image cache: found in file"));
+            data = readFile(index);
+            if (data != NULL)
+                {
+                    size = _files[index].size;
+                    _files[index].lastUsed = ++_useCount;
+                }
+            else
+                {
+                    // Something happened to the file, try the network instead
+                    evict(_files, index);
+                }
+        }
+    
+    if (data == NULL)
+        {
+            size = _spotify->getImage(imageUrl, &data);
+            if (size < 0)
+                {
+                    return -1;
+                }
+            if (_openStream != NULL)
+                {
+                    writeFile(urlHash, data, size);
+                }
+        }
+    
+    keepInRam(urlHash, data, size);
+    *imageData = data;
+    return size;
+}
+
+const char *SpotifyImageCache::getImageFile(char *imageUrl)
+{
+    if (_openStream == NULL)
+        {
+            return NULL;
+        }
+    
+    uint32_t urlHash = hashUrl(imageUrl);
+    int index = findImage(_files, SPOTIFY_IMAGE_CACHE_SIZE, urlHash);
+    if (index < 0)
+        {
+            // Downloading also writes the file, but not if it came from RAM
+            const uint8_t *data;
+            int size = getImage(imageUrl, &data);
+            if (size < 0)
+                {
+                    return NULL;
+                }
+            index = findImage(_files, SPOTIFY_IMAGE_CACHE_SIZE, urlHash);
+            if (index < 0)
+                {
+                    if (!writeFile(urlHash, data, size))
+                        {
+                            return NULL;
+                        }
+                    index = findImage(_files, SPOTIFY_IMAGE_CACHE_SIZE, urlHash);
+                }
+        }
+    
+    _files[index].lastUsed = ++_useCount;
+    setFileName(index);
+    return _fileName;
+}
+
+bool SpotifyImageCache::isCached(char *imageUrl)
+{
+    uint32_t urlHash = hashUrl(imageUrl);
+    return findImage(_ram, SPOTIFY_IMAGE_CACHE_RAM_SIZE, urlHash) >= 0 || findImage(_files, SPOTIFY_IMAGE_CACHE_SIZE, urlHash) >= 0;
+}
+
+void SpotifyImageCache::clear()
+{
+    for (int i = 0; i < SPOTIFY_IMAGE_CACHE_RAM_SIZE; i++)
+        {
+            evict(_ram, i);
+        }
+    for (int i = 0; i < SPOTIFY_IMAGE_CACHE_SIZE; i++)
+        {
+            evict(_files, i);
+        }
+}
+
+uint32_t SpotifyImageCache::hashUrl(const char *imageUrl)
+{
+    // FNV-1a
+    uint32_t urlHash = 2166136261UL;
+    for (const char *c = imageUrl; *c != '\0'; c++)
+        {
+            urlHash = (urlHash ^ (uint8_t)*c) * 16777619UL;
+        }
+    return urlHash;
+}
+
+int SpotifyImageCache::findImage(SpotifyCachedImage *images, int count, uint32_t urlHash)
+{
+    for (int i = 0; i < count; i++)
+        {
+            if (images[i].size > 0 && images[i].urlHash == urlHash)
+                {
+                    return i;
+                }
+        }
+    return -1;
+}
+
+int SpotifyImageCache::makeRoom(SpotifyCachedImage *images, int count, long budget, int size)
+{
+    // Drop the least recently used images until there is a free slot and
+    // the new image fits, or there is nothing left to drop.
+    while (true)
+        {
+            long used = 0;
+            int freeIndex = -1;
+            int oldestIndex = -1;
+            for (int i = 0; i < count; i++)
+                {
+                    if (images[i].size == 0)
+                        {
+                            if (freeIndex < 0)
+                                {
+                                    freeIndex = i;
+                                }
+                        }
+                    else
+                        {
+                            used += images[i].size;
+                            if (oldestIndex < 0 || images[i].lastUsed < images[oldestIndex].lastUsed)
+                                {
+                                    oldestIndex = i;
+                                }
+                        }
+                }
+            
+            if (oldestIndex < 0 || (freeIndex >= 0 && used + size <= budget))
+                {
+                    return freeIndex;
+                }
+            SPOTIFY_LOG_DEBUG(F("Image cache: evicting "));
+            SPOTIFY_LOG_DEBUGLN(oldestIndex);
+            evict(images, oldestIndex);
+        }
+}
+
+void SpotifyImageCache::evict(SpotifyCachedImage *images, int index)
+{
+    if (images[index].size == 0)
+        {
+            return;
+        }
+    
+    if (images == _ram)
+        {
+            free(images[index].data);
+        }
+    else if (_removeStream != NULL)
+        {
+            setFileName(index);
+            _removeStream(_fileName);
+        }
+    memset(&images[index], 0, sizeof(SpotifyCachedImage));
+}
+
+void SpotifyImageCache::setFileName(int index)
+{
+    snprintf(_fileName, sizeof(_fileName), "%s%d.jpg", filePrefix, index);
+}
+
+uint8_t *SpotifyImageCache::readFile(int index)
+{
+    setFileName(index);
+    Stream *stream = _openStream(_fileName, false);
+    if (stream == NULL)
+        {
+            return NULL;
+        }
+    
+    int size = _files[index].size;
+    uint8_t *data = (uint8_t *)malloc(size);
+    if (data != NULL && (int)stream->readBytes(data, size) != size)
+        {
+            free(data);
+            data = NULL;
+        }
+    _closeStream(stream);
+    return data;
+}
+
+bool SpotifyImageCache::writeFile(uint32_t urlHash, const uint8_t *data, int size)
+{
+    if (size > fileBudget)
+        {
+            return false;
+        }
+    
+    int index = makeRoom(_files, SPOTIFY_IMAGE_CACHE_SIZE, fileBudget, size);
+    setFileName(index);
+    Stream *stream = _openStream(_fileName, true);
+    if (stream == NULL)
+        {
+            SPOTIFY_LOG_ERROR(F("Image cache: failed to open "));
+            SPOTIFY_LOG_ERRORLN(_fileName);
+            return false;
+        }
+    
+    int written = stream->write(data, size);
+    _closeStream(stream);
+    if (written != size)
+        {
+            SPOTIFY_LOG_ERROR(F("Image cache: failed to write "));
+            SPOTIFY_LOG_ERRORLN(_fileName);
+            if (_removeStream != NULL)
+                {
+                    _removeStream(_fileName);
+                }
+            return false;
+        }
+    
+    _files[index].urlHash = urlHash;
+    _files[index].size = size;
+    _files[index].lastUsed = ++_useCount;
+    return true;
+}
+
+void SpotifyImageCache::keepInRam(uint32_t urlHash, uint8_t *data, int size)
+{
+    int index = makeRoom(_ram, SPOTIFY_IMAGE_CACHE_RAM_SIZE, ramBudget, size);
+    _ram[index].urlHash = urlHash;
+    _ram[index].size = size;
+    _ram[index].lastUsed = ++_useCount;
+    _ram[index].data = data;
+}
@@ -0,0 +1,108 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef SpotifyImageCache_h
+#define SpotifyImageCache_h
+
+#include <Arduino.h>
+#include "ArduinoSpotify.h"
+
+// How many images can be kept in files and in RAM
+#define SPOTIFY_IMAGE_CACHE_SIZE 8
+#define SPOTIFY_IMAGE_CACHE_RAM_SIZE 4
+#define SPOTIFY_IMAGE_FILE_NAME_LENGTH 32
+
+// The sketch opens, closes and removes the files, e.g. on SPIFFS:
+//
+//   fs::File imageFile;
+//   Stream *openImageFile(const char *fileName, bool forWriting) {
+//     imageFile = SPIFFS.open(fileName, forWriting ? "w" : "r");
+//     return imageFile ? &imageFile : NULL;
+//   }
+//   void closeImageFile(Stream *stream) { imageFile.close(); }
+//   void removeImageFile(const char *fileName) { SPIFFS.remove(fileName); }
+//
+//   SpotifyImageCache imageCache(spotify, openImageFile, closeImageFile, removeImageFile);
+typedef Stream *(*openImageStream)(const char *fileName, bool forWriting);
+typedef void (*closeImageStream)(Stream *stream);
+typedef void (*removeImageStream)(const char *fileName);
+
+struct SpotifyCachedImage
+{
+  uint32_t urlHash;
+  int size; // 0 if the slot is empty
+  unsigned long lastUsed;
+  uint8_t *data; // Only used for images in RAM
+};
+
+// Keeps recent album art so switching between a few albums doesn't
+// download the same images again. Images are found by a hash of their
+// URL, and the least recently used ones are dropped when a tier runs out
+// of slots or goes over its size budget.
+//
+// Files are named filePrefix followed by the slot number, so the space
+// used stays bounded even across reboots (the index itself is only kept
+// in RAM, so the files aren't reused after a reboot).
+class SpotifyImageCache
+{
+public:
+  // RAM only
+  SpotifyImageCache(ArduinoSpotify &spotify);
+  // Files, with recently used images also kept in RAM
+  SpotifyImageCache(ArduinoSpotify &spotify, openImageStream openStream, closeImageStream closeStream, removeImageStream removeStream = NULL);
+  ~SpotifyImageCache();
+
+  // Gets the image from RAM, a file or the network, in that order.
+  // Returns the size (-1 on failure). The data belongs to the cache and
+  // is only valid until the next call.
+  int getImage(char *imageUrl, const uint8_t **imageData);
+  // Makes sure the image is in a file and returns its name
+  // (e.g. for TJpgDec.drawFsJpg()), NULL on failure or with no files.
+  const char *getImageFile(char *imageUrl);
+
+  bool isCached(char *imageUrl);
+  void clear();
+
+  const char *filePrefix = "/art";
+  long fileBudget = 262144;
+  // The image just returned is always kept, even if it is over budget
+  long ramBudget = 16384;
+
+private:
+  ArduinoSpotify *_spotify;
+  openImageStream _openStream = NULL;
+  closeImageStream _closeStream = NULL;
+  removeImageStream _removeStream = NULL;
+  SpotifyCachedImage _files[SPOTIFY_IMAGE_CACHE_SIZE];
+  SpotifyCachedImage _ram[SPOTIFY_IMAGE_CACHE_RAM_SIZE];
+  unsigned long _useCount = 0;
+  char _fileName[SPOTIFY_IMAGE_FILE_NAME_LENGTH];
+
+  uint32_t hashUrl(const char *imageUrl);
+  int findImage(SpotifyCachedImage *images, int count, uint32_t urlHash);
+  int makeRoom(SpotifyCachedImage *images, int count, long budget, int size);
+  void evict(SpotifyCachedImage *images, int index);
+  void setFileName(int index);
+  uint8_t *readFile(int index);
+  bool writeFile(uint32_t urlHash, const uint8_t *data, int size);
+  void keepInRam(uint32_t urlHash, uint8_t *data, int size);
+};
+
+#endif
@@ -0,0 +1,92 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef SpotifyLog_h
+#define SpotifyLog_h
+
+// How much the library prints. Messages below the level are left out of
+// the build entirely, so they cost neither flash nor time.
+#define SPOTIFY_LOG_LEVEL_NONE 0
+#define SPOTIFY_LOG_LEVEL_ERROR 1
+#define SPOTIFY_LOG_LEVEL_WARN 2
+#define SPOTIFY_LOG_LEVEL_INFO 3
+#define SPOTIFY_LOG_LEVEL_DEBUG 4
+
+// I find setting these types of flags unreliable from the Arduino IDE
+// so uncomment this if its not working for you.
+// NOTE: Do not use the debug level on live-streams, it prints the
+// requests being made!
+
+//#define SPOTIFY_LOG_LEVEL SPOTIFY_LOG_LEVEL_DEBUG
+
+#ifndef SPOTIFY_LOG_LEVEL
+// SPOTIFY_DEBUG is the old way of turning on everything
+#ifdef SPOTIFY_DEBUG
+#define SPOTIFY_LOG_LEVEL SPOTIFY_LOG_LEVEL_DEBUG
+#else
+#define SPOTIFY_LOG_LEVEL SPOTIFY_LOG_LEVEL_ERROR
+#endif
+#endif
+
+#include <Arduino.h>
+
+// Where the messages go, Serial unless changed. NULL turns them off
+// (but they are still built in, lower SPOTIFY_LOG_LEVEL for that).
+extern Print *spotifyLogOutput;
+void setSpotifyLogOutput(Print *output);
+
+// Takes anything Print can print. Use F() for strings so they stay in flash.
+#define SPOTIFY_LOG_PRINT(x) do { if (spotifyLogOutput != NULL) { spotifyLogOutput->print(x); } } while (0)
+#define SPOTIFY_LOG_PRINTLN(x) do { if (spotifyLogOutput != NULL) { spotifyLogOutput->println(x); } } while (0)
+#define SPOTIFY_LOG_NOTHING do { } while (0)
+
+#if SPOTIFY_LOG_LEVEL >= SPOTIFY_LOG_LEVEL_ERROR
+#define SPOTIFY_LOG_ERROR(x) SPOTIFY_LOG_PRINT(x)
+#define SPOTIFY_LOG_ERRORLN(x) SPOTIFY_LOG_PRINTLN(x)
+#else
+#define SPOTIFY_LOG_ERROR(x) SPOTIFY_LOG_NOTHING
+#define SPOTIFY_LOG_ERRORLN(x) SPOTIFY_LOG_NOTHING
+#endif
+
+#if SPOTIFY_LOG_LEVEL >= SPOTIFY_LOG_LEVEL_WARN
+#define SPOTIFY_LOG_WARN(x) SPOTIFY_LOG_PRINT(x)
+#define SPOTIFY_LOG_WARNLN(x) SPOTIFY_LOG_PRINTLN(x)
+#else
+#define SPOTIFY_LOG_WARN(x) SPOTIFY_LOG_NOTHING
+#define SPOTIFY_LOG_WARNLN(x) SPOTIFY_LOG_NOTHING
+#endif
+
+#if SPOTIFY_LOG_LEVEL >= SPOTIFY_LOG_LEVEL_INFO
+#define SPOTIFY_LOG_INFO(x) SPOTIFY_LOG_PRINT(x)
+#define SPOTIFY_LOG_INFOLN(x) SPOTIFY_LOG_PRINTLN(x)
+#else
+#define SPOTIFY_LOG_INFO(x) SPOTIFY_LOG_NOTHING
+#define SPOTIFY_LOG_INFOLN(x) SPOTIFY_LOG_NOTHING
+#endif
+
+#if SPOTIFY_LOG_LEVEL >= SPOTIFY_LOG_LEVEL_DEBUG
+#define SPOTIFY_LOG_DEBUG(x) SPOTIFY_LOG_PRINT(x)
+#define SPOTIFY_LOG_DEBUGLN(x) SPOTIFY_LOG_PRINTLN(x)
+#else
+#define SPOTIFY_LOG_DEBUG(x) SPOTIFY_LOG_NOTHING
+#define SPOTIFY_LOG_DEBUGLN(x) SPOTIFY_LOG_NOTHING
+#endif
+
+#endif
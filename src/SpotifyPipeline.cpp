@@ -0,0 +1,105 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "SpotifyPipeline.h"
+
+bool SpotifyPipeline::addCurrentlyPlaying(processCurrentlyPlaying currentlyPlayingCallback, const char *market)
+{
+    SpotifyPipelinedRequest *request = addRequest(spotify_pipelined_currently_playing, market);
+    if (request == NULL)
+        {
+            return false;
+        }
+    request->currentlyPlayingCallback = currentlyPlayingCallback;
+    return true;
+}
+
+bool SpotifyPipeline::addPlayerDetails(processPlayerDetails playerDetailsCallback, const char *market)
+{
+    SpotifyPipelinedRequest *request = addRequest(spotify_pipelined_player_details, market);
+    if (request == NULL)
+        {
+            return false;
+        }
+    request->playerDetailsCallback = playerDetailsCallback;
+    return true;
+}
+
+bool SpotifyPipeline::addAudioFeatures(processAudioFeatures audioFeaturesCallback, const char *uri)
+{
+    SpotifyPipelinedRequest *request = addRequest(spotify_pipelined_audio_features, uri);
+    if (request == NULL)
+        {
+            return false;
+        }
+    request->audioFeaturesCallback = audioFeaturesCallback;
+    return true;
+}
+
+bool SpotifyPipeline::add(const char *command, processResponse responseCallback)
+{
+    SpotifyPipelinedRequest *request = addRequest(spotify_pipelined_get, command);
+    if (request == NULL)
+        {
+            return false;
+        }
+    request->responseCallback = responseCallback;
+    return true;
+}
+
+void SpotifyPipeline::clear()
+{
+    _count = 0;
+}
+
+int SpotifyPipeline::getCount()
+{
+    return _count;
+}
+
+SpotifyPipelinedRequest *SpotifyPipeline::getRequest(int index)
+{
+    if (index < 0 || index >= _count)
+        {
+            return NULL;
+        }
+    return &_requests[index];
+}
+
+int SpotifyPipeline::getStatusCode(int index)
+{
+    SpotifyPipelinedRequest *request = getRequest(index);
+    return request != NULL ? request->statusCode : -1;
+}
+
+SpotifyPipelinedRequest *SpotifyPipeline::addRequest(SpotifyPipelinedRequestType type, const char *argument)
+{
+    if (_count >= SPOTIFY_PIPELINE_SIZE)
+        {
+            return NULL;
+        }
+    
+    SpotifyPipelinedRequest *request = &_requests[_count++];
+    memset(request, 0, sizeof(SpotifyPipelinedRequest));
+    request->type = type;
+    request->argument = argument;
+    request->statusCode = -1;
+    return request;
+}
@@ -0,0 +1,84 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef SpotifyPipeline_h
+#define SpotifyPipeline_h
+
+#include <Arduino.h>
+#include "ArduinoSpotify.h"
+
+// Most requests in one pipeline
+#define SPOTIFY_PIPELINE_SIZE 4
+
+// Called with the status code and body of a request added with
+// SpotifyPipeline::add(). The body can only be read during the call,
+// anything left in it is skipped afterwards.
+typedef void (*processResponse)(int statusCode, Stream &body);
+
+enum SpotifyPipelinedRequestType
+{
+  spotify_pipelined_currently_playing,
+  spotify_pipelined_player_details,
+  spotify_pipelined_audio_features,
+  spotify_pipelined_get
+};
+
+struct SpotifyPipelinedRequest
+{
+  SpotifyPipelinedRequestType type;
+  // The market, track URI or command, depending on the type
+  const char *argument;
+  processCurrentlyPlaying currentlyPlayingCallback;
+  processPlayerDetails playerDetailsCallback;
+  processAudioFeatures audioFeaturesCallback;
+  processResponse responseCallback;
+  // -1 until a response for it has been read
+  int statusCode;
+};
+
+// A list of GET requests to api.spotify.com that don't depend on each
+// other. ArduinoSpotify::sendPipeline() writes them all to one connection
+// before reading the responses back in order, so they cost about one
+// round trip instead of one each. The strings passed in are not copied
+// and need to stay valid until then.
+class SpotifyPipeline
+{
+public:
+  // False if the pipeline is full
+  bool addCurrentlyPlaying(processCurrentlyPlaying currentlyPlayingCallback, const char *market = "");
+  bool addPlayerDetails(processPlayerDetails playerDetailsCallback, const char *market = "");
+  bool addAudioFeatures(processAudioFeatures audioFeaturesCallback, const char *uri);
+  // Any other endpoint, e.g. "/v1/me/player/devices"
+  bool add(const char *command, processResponse responseCallback);
+  void clear();
+
+  int getCount();
+  SpotifyPipelinedRequest *getRequest(int index);
+  // Of the request at index after sendPipeline(), -1 if it failed
+  int getStatusCode(int index);
+
+private:
+  SpotifyPipelinedRequest _requests[SPOTIFY_PIPELINE_SIZE];
+  int _count = 0;
+
+  SpotifyPipelinedRequest *addRequest(SpotifyPipelinedRequestType type, const char *argument);
+};
+
+#endif
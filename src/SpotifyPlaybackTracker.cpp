@@ -0,0 +1,129 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "SpotifyPlaybackTracker.h"
+
+void SpotifyPlaybackTracker::update(CurrentlyPlaying &currentlyPlaying)
+{
+    _progressMs = currentlyPlaying.progressMs;
+    _durationMs = currentlyPlaying.duraitonMs;
+    _isPlaying = currentlyPlaying.isPlaying;
+    _progressTime = millis();
+    _lastPollTime = _progressTime;
+    _hasData = true;
+}
+
+void SpotifyPlaybackTracker::update(PlayerDetails &playerDetails)
+{
+    _progressMs = playerDetails.progressMs;
+    // It may not be the same track any more
+    _durationMs = 0;
+    _isPlaying = playerDetails.isPlaying;
+    _progressTime = millis();
+    _lastPollTime = _progressTime;
+    _hasData = true;
+}
+
+void SpotifyPlaybackTracker::confirmUnchanged()
+{
+    _lastPollTime = millis();
+}
+
+void SpotifyPlaybackTracker::setNothingPlaying()
+{
+    // e.g. a 204 response, treated the same as being paused
+    _progressMs = 0;
+    _durationMs = 0;
+    _isPlaying = false;
+    _lastPollTime = millis();
+    _hasData = true;
+}
+
+void SpotifyPlaybackTracker::reset()
+{
+    _hasData = false;
+}
+
+long SpotifyPlaybackTracker::getProgressMs()
+{
+    if (!_isPlaying)
+        {
+            return _progressMs;
+        }
+    
+    // Unsigned subtraction, so this is still right when millis() wraps
+    long progressMs = _progressMs + (long)(millis() - _progressTime);
+    if (_durationMs > 0 && progressMs > _durationMs)
+        {
+            return _durationMs;
+        }
+    return progressMs;
+}
+
+long SpotifyPlaybackTracker::getDurationMs()
+{
+    return _durationMs;
+}
+
+bool SpotifyPlaybackTracker::isPlaying()
+{
+    return _isPlaying;
+}
+
+bool SpotifyPlaybackTracker::hasData()
+{
+    return _hasData;
+}
+
+bool SpotifyPlaybackTracker::isPollDue()
+{
+    return getTimeUntilPollDue() == 0;
+}
+
+unsigned long SpotifyPlaybackTracker::getTimeUntilPollDue()
+{
+    if (!_hasData)
+        {
+            return 0;
+        }
+    
+    unsigned long pollIntervalMs = _isPlaying ? maxPollIntervalMs : pausedPollIntervalMs;
+    unsigned long sinceLastPoll = millis() - _lastPollTime;
+    unsigned long dueIn = (sinceLastPoll < pollIntervalMs) ? pollIntervalMs - sinceLastPoll : 0;
+    
+    if (_isPlaying && _durationMs > 0)
+        {
+            // Check back just after the track should have finished
+            long expectedProgressMs = _progressMs + (long)(millis() - _progressTime);
+            long untilTrackEnd = _durationMs - expectedProgressMs + (long)trackEndMarginMs;
+            if (untilTrackEnd <= 0)
+                {
+                    // Past the end but the server still says it's playing
+                    // (e.g. a 304), so wait a bit before asking again
+                    untilTrackEnd = (sinceLastPoll < trackEndRetryMs) ? trackEndRetryMs - sinceLastPoll : 0;
+                }
+            if ((unsigned long)untilTrackEnd < dueIn)
+                {
+                    dueIn = untilTrackEnd;
+                }
+        }
+    
+    return dueIn;
+}
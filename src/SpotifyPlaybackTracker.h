@@ -0,0 +1,68 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef SpotifyPlaybackTracker_h
+#define SpotifyPlaybackTracker_h
+
+#include <Arduino.h>
+#include "ArduinoSpotify.h"
+
+// Keeps track of where playback should be between requests, so a
+// progress bar can be drawn smoothly without polling all the time.
+// Feed it every successful response, and only poll when isPollDue().
+class SpotifyPlaybackTracker
+{
+public:
+  void update(CurrentlyPlaying &currentlyPlaying);
+  // The player endpoint has no track length, so the end of the track
+  // isn't checked for until a CurrentlyPlaying comes in
+  void update(PlayerDetails &playerDetails);
+  // Call when a poll reported nothing has changed (status 304)
+  void confirmUnchanged();
+  void setNothingPlaying();
+  void reset();
+
+  long getProgressMs();
+  long getDurationMs();
+  bool isPlaying();
+  bool hasData();
+
+  bool isPollDue();
+  unsigned long getTimeUntilPollDue();
+
+  // Poll at least this often, to pick up changes made on other devices
+  unsigned long maxPollIntervalMs = 30000;
+  // Nothing is going to change by itself while paused, so check less often
+  unsigned long pausedPollIntervalMs = 60000;
+  // How long after the track should have ended to check what's next
+  unsigned long trackEndMarginMs = 1000;
+  // How often to check after that, until the next track shows up
+  unsigned long trackEndRetryMs = 5000;
+
+private:
+  long _progressMs = 0;
+  long _durationMs = 0;
+  bool _isPlaying = false;
+  bool _hasData = false;
+  unsigned long _progressTime = 0;
+  unsigned long _lastPollTime = 0;
+};
+
+#endif
@@ -0,0 +1,151 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "SpotifyPollScheduler.h"
+
+SpotifyPollScheduler::SpotifyPollScheduler(ArduinoSpotify &spotify)
+{
+    this->_spotify = &spotify;
+}
+
+int SpotifyPollScheduler::getCurrentlyPlaying(CurrentlyPlaying &currentlyPlaying, const char *market)
+{
+    if (!isPollDue())
+        {
+            return 0;
+        }
+    
+    int statusCode = _spotify->getCurrentlyPlaying(currentlyPlaying, market);
+    if (statusCode == 200)
+        {
+            tracker.update(currentlyPlaying);
+        }
+    reportStatusCode(statusCode);
+    return statusCode;
+}
+
+int SpotifyPollScheduler::getPlayerDetails(PlayerDetails &playerDetails, const char *market)
+{
+    if (!isPollDue())
+        {
+            return 0;
+        }
+    
+    int statusCode = _spotify->getPlayerDetails(playerDetails, market);
+    if (statusCode == 200)
+        {
+            tracker.update(playerDetails);
+        }
+    reportStatusCode(statusCode);
+    return statusCode;
+}
+
+void SpotifyPollScheduler::reportCurrentlyPlaying(CurrentlyPlaying &currentlyPlaying)
+{
+    tracker.update(currentlyPlaying);
+}
+
+void SpotifyPollScheduler::reportPlayerDetails(PlayerDetails &playerDetails)
+{
+    tracker.update(playerDetails);
+}
+
+void SpotifyPollScheduler::reportStatusCode(int statusCode)
+{
+    _lastPollTime = millis();
+    _polled = true;
+    
+    if (statusCode == 200 || statusCode == 204 || statusCode == 304)
+        {
+            _consecutiveErrors = 0;
+            _backoffMs = 0;
+            if (statusCode == 204)
+                {
+                    // Nothing playing
+                    tracker.setNothingPlaying();
+                }
+            else if (statusCode == 304)
+                {
+                    tracker.confirmUnchanged();
+                }
+            return;
+        }
+    
+    // Anything else is an error, wait twice as long each time it happens
+    // in a row. The random part stops a lot of devices that were throttled
+    // at the same time from all coming back at the same time.
+    if (_consecutiveErrors < 16)
+        {
+            _consecutiveErrors++;
+        }
+    unsigned long backoffMs = minBackoffMs << (_consecutiveErrors - 1);
+    if (backoffMs > maxBackoffMs || backoffMs < minBackoffMs)
+        {
+            backoffMs = maxBackoffMs;
+        }
+    backoffMs += random(backoffMs / 4 + 1);
+    
+    unsigned long retryAfterMs = _spotify->getRetryAfterMs();
+    if (statusCode == 429 && retryAfterMs > backoffMs)
+        {
+            backoffMs = retryAfterMs;
+        }
+    
+    SPOTIFY_LOG_WARN(F("Request failed, backing off for (ms): "));
+    SPOTIFY_LOG_WARNLN(backoffMs);
+    
+    _backoffMs = backoffMs;
+    _backoffStartTime = millis();
+}
+
+bool SpotifyPollScheduler::isPollDue()
+{
+    return getTimeUntilPollDue() == 0;
+}
+
+bool SpotifyPollScheduler::isBackingOff()
+{
+    return _backoffMs > 0 && millis() - _backoffStartTime < _backoffMs;
+}
+
+unsigned long SpotifyPollScheduler::getTimeUntilPollDue()
+{
+    unsigned long dueIn;
+    if (_backoffMs > 0)
+        {
+            unsigned long sinceBackoffStart = millis() - _backoffStartTime;
+            dueIn = (sinceBackoffStart < _backoffMs) ? _backoffMs - sinceBackoffStart : 0;
+        }
+    else
+        {
+            dueIn = tracker.getTimeUntilPollDue();
+        }
+    
+    // Whatever the tracker thinks, never ask more often than this
+    if (_polled)
+        {
+            unsigned long sinceLastPoll = millis() - _lastPollTime;
+            if (sinceLastPoll < minPollIntervalMs && minPollIntervalMs - sinceLastPoll > dueIn)
+                {
+                    dueIn = minPollIntervalMs - sinceLastPoll;
+                }
+        }
+    return dueIn;
+}
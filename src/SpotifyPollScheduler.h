@@ -0,0 +1,68 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef SpotifyPollScheduler_h
+#define SpotifyPollScheduler_h
+
+#include <Arduino.h>
+#include "ArduinoSpotify.h"
+#include "SpotifyPlaybackTracker.h"
+
+// Decides when to next ask Spotify what is playing. Polls just after the
+// current track should end, less often while paused, never more often
+// than minPollIntervalMs, and backs off exponentially on errors, waiting
+// at least as long as a 429's Retry-After header asks.
+class SpotifyPollScheduler
+{
+public:
+  SpotifyPollScheduler(ArduinoSpotify &spotify);
+
+  // Make the request only if it is due. Returns 0 if it wasn't,
+  // otherwise the status code of the request.
+  int getCurrentlyPlaying(CurrentlyPlaying &currentlyPlaying, const char *market = "");
+  int getPlayerDetails(PlayerDetails &playerDetails, const char *market = "");
+
+  // For requests made some other way (e.g. startCurrentlyPlaying),
+  // report the results so the schedule stays right.
+  void reportCurrentlyPlaying(CurrentlyPlaying &currentlyPlaying);
+  void reportPlayerDetails(PlayerDetails &playerDetails);
+  void reportStatusCode(int statusCode);
+
+  bool isPollDue();
+  unsigned long getTimeUntilPollDue();
+  bool isBackingOff();
+
+  SpotifyPlaybackTracker tracker;
+
+  // Measured from the last reported status code
+  unsigned long minPollIntervalMs = 2000;
+  unsigned long minBackoffMs = 2000;
+  unsigned long maxBackoffMs = 300000;
+
+private:
+  ArduinoSpotify *_spotify;
+  int _consecutiveErrors = 0;
+  unsigned long _backoffMs = 0;
+  unsigned long _backoffStartTime = 0;
+  unsigned long _lastPollTime = 0;
+  bool _polled = false;
+};
+
+#endif
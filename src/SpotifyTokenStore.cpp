@@ -0,0 +1,92 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "SpotifyTokenStore.h"
+
+bool SpotifyMemoryTokenStore::load(char *accessToken, size_t size, unsigned long *expiresAt)
+{
+    if (_expiresAt == 0 || strlen(_accessToken) >= size)
+        {
+            return false;
+        }
+    
+    strcpy(accessToken, _accessToken);
+    *expiresAt = _expiresAt;
+    return true;
+}
+
+bool SpotifyMemoryTokenStore::save(const char *accessToken, unsigned long expiresAt)
+{
+    if (strlen(accessToken) >= sizeof(_accessToken))
+        {
+            return false;
+        }
+    
+    strcpy(_accessToken, accessToken);
+    _expiresAt = expiresAt;
+    return true;
+}
+
+SpotifyStreamTokenStore::SpotifyStreamTokenStore(openTokenStream openStream, closeTokenStream closeStream)
+{
+    this->_openStream = openStream;
+    this->_closeStream = closeStream;
+}
+
+bool SpotifyStreamTokenStore::load(char *accessToken, size_t size, unsigned long *expiresAt)
+{
+    Stream *stream = _openStream(false);
+    if (stream == NULL)
+        {
+            return false;
+        }
+    
+    // Stored as two lines, the expiry time and then the token
+    char expiresAtBuff[16];
+    size_t expiresAtLength = stream->readBytesUntil('\n', expiresAtBuff, sizeof(expiresAtBuff) - 1);
+    expiresAtBuff[expiresAtLength] = '\0';
+    size_t tokenLength = stream->readBytesUntil('\n', accessToken, size - 1);
+    accessToken[tokenLength] = '\0';
+    // Filling the buffer without reaching the end means it was cut short
+    int next = stream->peek();
+    bool truncated = tokenLength == size - 1 && next >= 0 && next != '\n';
+    _closeStream(stream);
+    
+    *expiresAt = strtoul(expiresAtBuff, NULL, 10);
+    return *expiresAt != 0 && tokenLength > 0 && !truncated;
+}
+
+bool SpotifyStreamTokenStore::save(const char *accessToken, unsigned long expiresAt)
+{
+    Stream *stream = _openStream(true);
+    if (stream == NULL)
+        {
+            return false;
+        }
+    
+    // Any of these can fail if e.g. the file system is full
+    bool written = stream->print(expiresAt) > 0;
+    written = written && stream->print('\n') == 1;
+    written = written && stream->print(accessToken) == strlen(accessToken);
+    written = written && stream->print('\n') == 1;
+    _closeStream(stream);
+    
+    return written;
+}
@@ -0,0 +1,78 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef SpotifyTokenStore_h
+#define SpotifyTokenStore_h
+
+#include <Arduino.h>
+
+// Longest access token that can be used, including the terminating null
+#define SPOTIFY_STORED_TOKEN_CHAR_LENGTH 256
+
+// Somewhere to keep the access token between reboots, so a device that
+// wakes up often doesn't need to ask for a new one every time.
+// expiresAt is a unix timestamp in seconds. load() returns false if the
+// token doesn't fit in size.
+class SpotifyTokenStore
+{
+public:
+  virtual bool load(char *accessToken, size_t size, unsigned long *expiresAt) = 0;
+  virtual bool save(const char *accessToken, unsigned long expiresAt) = 0;
+};
+
+// Only lasts as long as the sketch is running (not through a reset or
+// deep sleep), mostly useful for testing.
+class SpotifyMemoryTokenStore : public SpotifyTokenStore
+{
+public:
+  bool load(char *accessToken, size_t size, unsigned long *expiresAt);
+  bool save(const char *accessToken, unsigned long expiresAt);
+
+private:
+  char _accessToken[SPOTIFY_STORED_TOKEN_CHAR_LENGTH];
+  unsigned long _expiresAt = 0;
+};
+
+// The sketch opens and closes the Stream, e.g. a file on SPIFFS:
+//
+//   fs::File tokenFile;
+//   Stream *openTokenFile(bool forWriting) {
+//     tokenFile = SPIFFS.open("/token.txt", forWriting ? "w" : "r");
+//     return tokenFile ? &tokenFile : NULL;
+//   }
+//   void closeTokenFile(Stream *stream) { tokenFile.close(); }
+//
+//   SpotifyStreamTokenStore tokenStore(openTokenFile, closeTokenFile);
+typedef Stream *(*openTokenStream)(bool forWriting);
+typedef void (*closeTokenStream)(Stream *stream);
+
+class SpotifyStreamTokenStore : public SpotifyTokenStore
+{
+public:
+  SpotifyStreamTokenStore(openTokenStream openStream, closeTokenStream closeStream);
+  bool load(char *accessToken, size_t size, unsigned long *expiresAt);
+  bool save(const char *accessToken, unsigned long expiresAt);
+
+private:
+  openTokenStream _openStream;
+  closeTokenStream _closeStream;
+};
+
+#endif